@@ -6,9 +6,34 @@ CONFIG += c++17 cmdline
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# zstd — если есть libzstd (pkg-config), иначе клиентам предлагается только deflate
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += MESSENGER_HAVE_ZSTD
+}
+
 SOURCES += \
+        blobstore.cpp \
+        compression.cpp \
+        config.cpp \
+        filetransfer.cpp \
+        historycache.cpp \
+        listener.cpp \
+        logger.cpp \
+        logstore.cpp \
         main.cpp \
-        server.cpp
+        memorystore.cpp \
+        messagestore.cpp \
+        messagewriter.cpp \
+        metrics.cpp \
+        outboundqueue.cpp \
+        pgstore.cpp \
+        protocol.cpp \
+        server.cpp \
+        statsserver.cpp \
+        timerwheel.cpp \
+        userdirectory.cpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -16,4 +41,25 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 HEADERS += \
-    server.h
+    blobstore.h \
+    compression.h \
+    config.h \
+    filetransfer.h \
+    historycache.h \
+    listener.h \
+    logger.h \
+    logstore.h \
+    mailbox.h \
+    memorystore.h \
+    messagestore.h \
+    messagewriter.h \
+    metrics.h \
+    outboundqueue.h \
+    pgstore.h \
+    protocol.h \
+    server.h \
+    servercontext.h \
+    session.h \
+    statsserver.h \
+    timerwheel.h \
+    userdirectory.h
@@ -0,0 +1,23 @@
+QT = core network
+
+CONFIG += c++17 cmdline
+
+TARGET = MessengerBench
+
+# Протокол и гистограммы — те же, что у сервера
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../metrics.cpp \
+        ../protocol.cpp \
+        benchclient.cpp \
+        benchconfig.cpp \
+        benchrunner.cpp \
+        main.cpp
+
+HEADERS += \
+    ../metrics.h \
+    ../protocol.h \
+    benchclient.h \
+    benchconfig.h \
+    benchrunner.h
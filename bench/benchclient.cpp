@@ -0,0 +1,279 @@
+#include "benchclient.h"
+
+namespace {
+constexpr qint64 kChunkSize = 64 * 1024;
+constexpr qint64 kUploadWindow = 256 * 1024;
+
+const QByteArray &fileFiller()
+{
+    static const QByteArray filler(kChunkSize, 'f');
+    return filler;
+}
+}
+
+BenchClient::BenchClient(const QString &nick, const QString &peer, const BenchConfig &config,
+                         BenchStats *stats, QObject *parent)
+    : QObject(parent)
+    , m_nick(nick)
+    , m_peer(peer)
+    , m_config(config)
+    , m_stats(stats)
+    , m_socket(new QTcpSocket(this))
+{
+    connect(m_socket, &QTcpSocket::connected, this, &BenchClient::onConnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &BenchClient::onReadyRead);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &BenchClient::onBytesWritten);
+    connect(m_socket, &QTcpSocket::disconnected, this, &BenchClient::onDisconnected);
+    connect(m_socket, &QTcpSocket::errorOccurred, this, &BenchClient::onError);
+}
+
+void BenchClient::start()
+{
+    m_state = State::Connecting;
+    m_connectStartedAt = monotonicNanos();
+    m_socket->connectToHost(m_config.host, m_config.port);
+}
+
+void BenchClient::reconnect(const QString &nick)
+{
+    m_nick = nick;
+    m_state = State::Reconnecting;
+    m_socket->disconnectFromHost();
+}
+
+void BenchClient::onConnected()
+{
+    m_state = State::Registering;
+    m_socket->write(Protocol::preamble());
+    writeFrame(Protocol::FrameType::Text, m_nick.toUtf8());
+}
+
+void BenchClient::onDisconnected()
+{
+    m_decoder = Protocol::FrameDecoder();
+    m_pendingAcks.clear();
+    m_incomingRelays.clear();
+    m_historySentAt = 0;
+    m_uploadStartedAt = 0;
+
+    if (m_state == State::Reconnecting) {
+        start();
+        return;
+    }
+    if (m_state != State::Idle) {
+        m_stats->disconnects.add();
+        m_state = State::Idle;
+        emit failed(this);
+    }
+}
+
+void BenchClient::onError(QAbstractSocket::SocketError error)
+{
+    if (error == QAbstractSocket::RemoteHostClosedError) return; // это обычный disconnected
+    if (m_state == State::Connecting) {
+        m_stats->connectFailures.add();
+        m_state = State::Idle;
+        emit failed(this);
+    }
+}
+
+void BenchClient::writeFrame(Protocol::FrameType type, QByteArrayView payload)
+{
+    m_socket->write(Protocol::encodeFrame(type, payload));
+}
+
+void BenchClient::sendMessage()
+{
+    // Время отправки едет в самом тексте: получатель на той же машине, часы общие
+    QByteArray text = m_peer.toUtf8() + ":bench " + QByteArray::number(monotonicNanos()) + ' ';
+    text.append(QByteArray(m_config.messageSize, 'x'));
+    writeFrame(Protocol::FrameType::Text, text);
+
+    m_pendingAcks.push_back({monotonicNanos(), false});
+    if (measuring()) m_stats->sent.add();
+}
+
+void BenchClient::requestHistory()
+{
+    m_historySentAt = monotonicNanos();
+    writeFrame(Protocol::FrameType::Text, ("/get_history " + m_peer).toUtf8());
+}
+
+void BenchClient::startUpload()
+{
+    ++m_transferId;
+    m_uploadStartedAt = monotonicNanos();
+    m_uploadOffset = -1;
+
+    // Имя свое на каждую загрузку, иначе сервер решит, что это докачка прошлой
+    QByteArray payload;
+    Protocol::appendVarint(payload, m_transferId);
+    Protocol::appendField(payload, m_peer.toUtf8());
+    Protocol::appendField(payload, QString("bench-%1.bin").arg(m_transferId).toUtf8());
+    Protocol::appendVarint(payload, quint64(m_config.fileSize));
+    writeFrame(Protocol::FrameType::FileBegin, payload);
+}
+
+void BenchClient::onBytesWritten()
+{
+    pumpUpload();
+}
+
+void BenchClient::pumpUpload()
+{
+    if (m_uploadStartedAt == 0 || m_uploadOffset < 0 || m_uploadOffset >= m_config.fileSize) return;
+
+    while (m_uploadOffset < m_config.fileSize && m_socket->bytesToWrite() < kUploadWindow) {
+        const qint64 size = qMin(kChunkSize, m_config.fileSize - m_uploadOffset);
+        QByteArray payload;
+        Protocol::appendVarint(payload, m_transferId);
+        QByteArray chunk = fileFiller().first(size);
+        if (m_uploadOffset == 0) {
+            // Содержимое у каждой загрузки свое, чтобы хранилище не схлопнуло их в один файл
+            const QByteArray unique = (m_nick + ":" + QString::number(m_transferId)).toUtf8().left(size);
+            chunk.replace(0, unique.size(), unique);
+        }
+        payload.append(chunk);
+        writeFrame(Protocol::FrameType::FileChunk, payload);
+        m_uploadOffset += size;
+    }
+
+    if (m_uploadOffset == m_config.fileSize)
+        m_pendingAcks.push_back({m_uploadStartedAt, true});
+}
+
+void BenchClient::onReadyRead()
+{
+    m_decoder.feed(m_socket->readAll());
+
+    Protocol::Frame frame;
+    Protocol::FrameDecoder::Status status;
+    while ((status = m_decoder.next(frame)) == Protocol::FrameDecoder::Status::Frame)
+        handleFrame(frame);
+
+    if (status == Protocol::FrameDecoder::Status::Error)
+        m_socket->abort();
+}
+
+void BenchClient::handleFrame(const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    switch (frame.type) {
+    case Protocol::FrameType::Text:
+        handleText(QString::fromUtf8(frame.payload));
+        return;
+
+    case Protocol::FrameType::Ack: {
+        if (m_pendingAcks.empty()) return;
+        const PendingAck ack = m_pendingAcks.front();
+        m_pendingAcks.pop_front();
+        if (!measuring()) {
+            if (ack.file) m_uploadStartedAt = 0;
+            return;
+        }
+
+        const qint64 latency = monotonicNanos() - ack.sentAt;
+        if (ack.file) {
+            m_stats->uploadLatency.record(latency);
+            m_stats->uploadsDone.add();
+            m_stats->uploadBytes.add(m_config.fileSize);
+            m_uploadStartedAt = 0;
+        } else {
+            m_stats->ackLatency.record(latency);
+            m_stats->acked.add();
+        }
+        return;
+    }
+
+    case Protocol::FrameType::FileAck: {
+        quint64 id = 0, offset = 0;
+        if (reader.readVarint(id) && reader.readVarint(offset) && id == m_transferId) {
+            m_uploadOffset = qint64(offset);
+            pumpUpload();
+        }
+        return;
+    }
+
+    case Protocol::FrameType::FileBegin: {
+        quint64 relayId = 0;
+        if (reader.readVarint(relayId)) m_incomingRelays.insert(relayId);
+        return;
+    }
+
+    case Protocol::FrameType::FileChunk: {
+        quint64 relayId = 0;
+        if (reader.readVarint(relayId) && measuring()) m_stats->relayBytes.add(reader.rest().size());
+        return;
+    }
+
+    case Protocol::FrameType::FileEnd: {
+        quint64 id = 0;
+        if (!reader.readVarint(id)) return;
+        if (m_incomingRelays.remove(id)) return;
+        // Не пересылка к нам — значит, сервер отказал в нашей загрузке
+        if (id == m_transferId && m_uploadStartedAt != 0) {
+            m_uploadStartedAt = 0;
+            m_stats->rejected.add();
+        }
+        return;
+    }
+
+    case Protocol::FrameType::Ping:
+        // Не ответим — сервер отключит молчащих клиентов посреди прогона
+        writeFrame(Protocol::FrameType::Pong, frame.payload);
+        return;
+
+    default:
+        return; // присутствие, ссылки на файлы и т.п. замеру не нужны
+    }
+}
+
+void BenchClient::handleText(const QString &text)
+{
+    if (m_state == State::Registering) {
+        if (text.startsWith("USERS_LIST:")) {
+            m_state = State::Ready;
+            if (measuring()) {
+                m_stats->joinLatency.record(monotonicNanos() - m_connectStartedAt);
+                m_stats->joins.add();
+            }
+            emit ready(this);
+        } else if (text.startsWith("SYSTEM: Invalid nickname") || text.startsWith("SYSTEM: Nickname is already taken")) {
+            m_state = State::Idle;
+            m_socket->abort();
+            emit failed(this);
+        }
+        return;
+    }
+
+    // "hh:mm отправитель: bench <наносекунды> xxx"
+    const int marker = text.indexOf(": bench ");
+    if (marker > 6) {
+        if (text.mid(6, marker - 6) == m_nick && m_peer != m_nick) return; // эхо своего же сообщения
+        if (measuring()) {
+            const qint64 sentAt = text.mid(marker + 8).section(' ', 0, 0).toLongLong();
+            m_stats->deliveryLatency.record(monotonicNanos() - sentAt);
+            m_stats->delivered.add();
+        }
+        return;
+    }
+
+    if (text.startsWith("HISTORY_CURSOR:")) {
+        if (m_historySentAt != 0 && measuring()) {
+            m_stats->historyLatency.record(monotonicNanos() - m_historySentAt);
+            m_stats->historyReplies.add();
+        }
+        m_historySentAt = 0;
+        return;
+    }
+
+    if (text.startsWith("SYSTEM: Server is busy")) {
+        // Какое именно сообщение отвергли, не узнать — выкидываем самое свежее ожидание
+        if (!m_pendingAcks.empty()) m_pendingAcks.pop_back();
+        if (measuring()) m_stats->rejected.add();
+    } else if (text.startsWith("SYSTEM: User not found")) {
+        // Сообщение не сохранено, Ack не придет — иначе следующие Ack лягут на чужие ожидания
+        if (!m_pendingAcks.empty()) m_pendingAcks.pop_back();
+        if (measuring()) m_stats->undelivered.add();
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef BENCHCLIENT_H
+#define BENCHCLIENT_H
+
+#include <QObject>
+#include <QSet>
+#include <QTcpSocket>
+#include <atomic>
+#include <deque>
+#include "benchconfig.h"
+#include "metrics.h"
+#include "protocol.h"
+
+// Общие на все потоки счетчики прогона. Пока measuring == false (подключение, разогрев),
+// задержки не пишем — в отчет попадает только замеренное окно
+struct BenchStats {
+    std::atomic<bool> measuring{false};
+
+    Counter connectFailures;
+    Counter disconnects;
+    Counter sent;
+    Counter delivered;
+    Counter acked;
+    Counter rejected;       // "Server is busy"
+    Counter undelivered;    // "User not found": собеседник как раз переподключается
+    Counter historyReplies;
+    Counter uploadsDone;
+    Counter uploadBytes;
+    Counter relayBytes;     // байты файлов, пришедшие получателям
+    Counter joins;
+
+    Histogram deliveryLatency; // отправка -> получатель увидел сообщение
+    Histogram ackLatency;      // отправка -> сервер подтвердил запись в БД
+    Histogram historyLatency;  // /get_history -> HISTORY_CURSOR
+    Histogram uploadLatency;   // FileBegin -> Ack
+    Histogram joinLatency;     // подключение -> USERS_LIST
+};
+
+// Один имитируемый клиент на бинарном протоколе
+class BenchClient : public QObject {
+    Q_OBJECT
+public:
+    BenchClient(const QString &nick, const QString &peer, const BenchConfig &config,
+                BenchStats *stats, QObject *parent = nullptr);
+
+    void start();
+    // Отключиться и войти заново под другим ником
+    void reconnect(const QString &nick);
+
+    bool isReady() const { return m_state == State::Ready; }
+    // Ждет ответа на историю или заканчивает загрузку — новую операцию не начинаем
+    bool isBusy() const { return m_historySentAt != 0 || m_uploadStartedAt != 0; }
+    int pendingAcks() const { return int(m_pendingAcks.size()); }
+    const QString &nick() const { return m_nick; }
+
+    void sendMessage();
+    void requestHistory();
+    void startUpload();
+
+signals:
+    void ready(BenchClient *client);
+    void failed(BenchClient *client);
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onBytesWritten();
+    void onDisconnected();
+    void onError(QAbstractSocket::SocketError error);
+
+private:
+    enum class State {
+        Idle,
+        Connecting,
+        Registering,
+        Ready,
+        Reconnecting
+    };
+
+    struct PendingAck {
+        qint64 sentAt = 0;
+        bool file = false;
+    };
+
+    void handleFrame(const Protocol::Frame &frame);
+    void handleText(const QString &text);
+    void writeFrame(Protocol::FrameType type, QByteArrayView payload);
+    void pumpUpload();
+    bool measuring() const { return m_stats->measuring.load(std::memory_order_relaxed); }
+
+    QString m_nick;
+    QString m_peer;
+    const BenchConfig &m_config;
+    BenchStats *m_stats;
+
+    QTcpSocket *m_socket;
+    Protocol::FrameDecoder m_decoder;
+    State m_state = State::Idle;
+    qint64 m_connectStartedAt = 0;
+
+    std::deque<PendingAck> m_pendingAcks; // подтверждения приходят в порядке отправки
+    qint64 m_historySentAt = 0;
+
+    quint64 m_transferId = 0;
+    qint64 m_uploadStartedAt = 0;
+    qint64 m_uploadOffset = -1; // -1 — ждем FileAck
+    QSet<quint64> m_incomingRelays;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "benchconfig.h"
+#include <QCommandLineParser>
+#include <cstdio>
+#include <cstdlib>
+
+QString BenchConfig::workloadName(Workload workload)
+{
+    switch (workload) {
+    case Workload::Messages: return "messages";
+    case Workload::Churn:    return "churn";
+    case Workload::History:  return "history";
+    case Workload::Upload:   return "upload";
+    }
+    return "messages";
+}
+
+BenchConfig BenchConfig::fromArguments(const QStringList &arguments)
+{
+    BenchConfig config;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Load generator for MessengerServer");
+    parser.addHelpOption();
+
+    QCommandLineOption hostOption("host", "Server address.", "host", config.host);
+    QCommandLineOption portOption("port", "Server port.", "port", QString::number(config.port));
+    QCommandLineOption clientsOption("clients", "Simulated clients.", "count", QString::number(config.clients));
+    QCommandLineOption threadsOption("threads", "Client event loops.", "count", QString::number(config.threads));
+    QCommandLineOption workloadOption("workload", "messages, churn, history or upload.", "name", "messages");
+    QCommandLineOption durationOption("duration", "Measured seconds.", "secs", QString::number(config.durationSecs));
+    QCommandLineOption rateOption("rate", "Operations per second per client.", "rate", QString::number(config.rate));
+    QCommandLineOption sizeOption("message-size", "Private message payload bytes.", "bytes",
+                                  QString::number(config.messageSize));
+    QCommandLineOption fileOption("file-size", "Upload size in KB.", "kb", QString::number(config.fileSize / 1024));
+    QCommandLineOption seedOption("history-seed", "Messages per pair before the history run.", "count",
+                                  QString::number(config.historySeed));
+    QCommandLineOption pidOption("server-pid", "Server process to sample RSS from.", "pid");
+    QCommandLineOption outputOption("output", "Write the JSON report to this file.", "path");
+    QCommandLineOption baselineOption("baseline", "Earlier JSON report to compare against.", "path");
+    parser.addOptions({hostOption, portOption, clientsOption, threadsOption, workloadOption, durationOption,
+                       rateOption, sizeOption, fileOption, seedOption, pidOption, outputOption, baselineOption});
+    parser.process(arguments);
+
+    config.host = parser.value(hostOption);
+    config.port = parser.value(portOption).toUShort();
+    config.clients = qMax(2, parser.value(clientsOption).toInt());
+    config.threads = qBound(1, parser.value(threadsOption).toInt(), config.clients);
+    config.durationSecs = qMax(1, parser.value(durationOption).toInt());
+    config.rate = qMax(0.01, parser.value(rateOption).toDouble());
+    config.messageSize = qBound(0, parser.value(sizeOption).toInt(), 60000);
+    config.fileSize = qMax(1LL, parser.value(fileOption).toLongLong()) * 1024;
+    config.historySeed = qMax(0, parser.value(seedOption).toInt());
+    config.serverPid = parser.value(pidOption).toLongLong();
+    config.output = parser.value(outputOption);
+    config.baseline = parser.value(baselineOption);
+
+    const QString workload = parser.value(workloadOption);
+    if (workload == "churn")
+        config.workload = Workload::Churn;
+    else if (workload == "history")
+        config.workload = Workload::History;
+    else if (workload == "upload")
+        config.workload = Workload::Upload;
+    else if (workload == "messages")
+        config.workload = Workload::Messages;
+    else {
+        // Опечатка не должна молча превращаться в другой прогон — выходим, как и process()
+        std::fprintf(stderr, "Unknown value \"%s\" for --workload\n", qPrintable(workload));
+        std::exit(1);
+    }
+
+    return config;
+}
@@ -0,0 +1,34 @@
+#ifndef BENCHCONFIG_H
+#define BENCHCONFIG_H
+
+#include <QString>
+#include <QStringList>
+
+// Что гоняем
+enum class Workload {
+    Messages, // шторм личных сообщений по кольцу: клиент i пишет клиенту i+1
+    Churn,    // клиенты отключаются и входят заново под новым ником (рассылка присутствия)
+    History,  // /get_history залпами по заранее накиданной переписке
+    Upload    // параллельные загрузки файлов потоковыми кадрами
+};
+
+struct BenchConfig {
+    QString host = "127.0.0.1";
+    quint16 port = 1234;
+    int clients = 1000;
+    int threads = 4;
+    Workload workload = Workload::Messages;
+    int durationSecs = 30;
+    double rate = 10.0;      // операций в секунду на клиента
+    int messageSize = 32;    // полезная нагрузка личного сообщения
+    qint64 fileSize = 256 * 1024;
+    int historySeed = 50;    // сколько сообщений накидать каждой паре перед замером истории
+    qint64 serverPid = 0;    // 0 — найти процесс MessengerServer самим
+    QString output;          // пусто — stdout
+    QString baseline;        // прошлый отчет для сравнения
+
+    static BenchConfig fromArguments(const QStringList &arguments);
+    static QString workloadName(Workload workload);
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "benchrunner.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <cstdio>
+
+namespace {
+constexpr int kConnectBatch = 50;     // клиентов за один шаг подключения (шаг — 10 мс)
+constexpr int kTickMs = 10;
+constexpr double kMaxCredit = 10.0;   // после подвисания не выстреливаем сразу сотней операций
+constexpr int kSeedTimeoutMs = 60000;
+constexpr int kDrainMs = 1000;        // дождаться того, что еще в пути, после конца нагрузки
+
+void progress(const QString &text)
+{
+    std::fprintf(stderr, "%s\n", qPrintable(text));
+}
+
+QJsonObject latencyJson(const Histogram &histogram)
+{
+    QJsonObject out;
+    out["count"] = double(histogram.count());
+    out["p50_us"] = double(histogram.quantile(0.5)) / 1000.0;
+    out["p99_us"] = double(histogram.quantile(0.99)) / 1000.0;
+    out["p999_us"] = double(histogram.quantile(0.999)) / 1000.0;
+    return out;
+}
+
+double changePercent(double now, double before)
+{
+    return before == 0.0 ? 0.0 : (now - before) / before * 100.0;
+}
+}
+
+BenchWorker::BenchWorker(int index, int firstClient, int clientCount, const BenchConfig &config,
+                         BenchStats *stats, const QString &tag, QObject *parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_firstClient(firstClient)
+    , m_clientCount(clientCount)
+    , m_config(config)
+    , m_stats(stats)
+    , m_tag(tag)
+{
+}
+
+QString BenchWorker::nickFor(int client, int generation) const
+{
+    // Ник не длиннее 20 символов: b<тег>_<клиент>[_<поколение>]
+    QString nick = QString("b%1_%2").arg(m_tag).arg(client);
+    if (generation > 0) nick += QString("_%1").arg(generation);
+    return nick;
+}
+
+// Уже в потоке воркера: сокеты и таймеры создаются здесь
+void BenchWorker::connectClients()
+{
+    for (int i = 0; i < m_clientCount; ++i) {
+        const int client = m_firstClient + i;
+        auto *benchClient = new BenchClient(nickFor(client, 0), nickFor((client + 1) % m_config.clients, 0),
+                                            m_config, m_stats, this);
+        connect(benchClient, &BenchClient::ready, this, [this]() {
+            if (m_settled < m_clientCount) {
+                m_readyCount.fetch_add(1);
+                if (++m_settled == m_clientCount) emit connected(m_index);
+            }
+        });
+        connect(benchClient, &BenchClient::failed, this, [this]() {
+            if (m_settled < m_clientCount && ++m_settled == m_clientCount) emit connected(m_index);
+        });
+        m_clients.append(benchClient);
+        m_credit.append(0.0);
+        m_generation.append(0);
+    }
+
+    m_connectTimer = new QTimer(this);
+    connect(m_connectTimer, &QTimer::timeout, this, &BenchWorker::connectNextBatch);
+    m_connectTimer->start(kTickMs);
+
+    m_tickTimer = new QTimer(this);
+    connect(m_tickTimer, &QTimer::timeout, this, &BenchWorker::tick);
+}
+
+void BenchWorker::connectNextBatch()
+{
+    for (int i = 0; i < kConnectBatch && m_nextToConnect < m_clients.size(); ++i)
+        m_clients.at(m_nextToConnect++)->start();
+    if (m_nextToConnect == m_clients.size()) m_connectTimer->stop();
+}
+
+// Каждой паре накидываем переписку, чтобы /get_history было что отдавать
+void BenchWorker::seedHistory()
+{
+    m_seedLeft = m_config.historySeed;
+    auto *seedTimer = new QTimer(this);
+    auto *elapsed = new QElapsedTimer;
+    elapsed->start();
+
+    connect(seedTimer, &QTimer::timeout, this, [this, seedTimer, elapsed]() {
+        if (m_seedLeft > 0) {
+            --m_seedLeft;
+            for (BenchClient *client : std::as_const(m_clients)) {
+                if (client->isReady()) client->sendMessage();
+            }
+            return;
+        }
+
+        // Ждем, пока все легло в БД, иначе первые запросы истории пойдут мимо кэша не по делу
+        int pending = 0;
+        for (BenchClient *client : std::as_const(m_clients))
+            pending += client->pendingAcks();
+        m_pendingAcks.store(pending);
+        if (pending > 0 && !elapsed->hasExpired(kSeedTimeoutMs)) return;
+
+        seedTimer->deleteLater();
+        delete elapsed;
+        emit seeded(m_index);
+    });
+    seedTimer->start(kTickMs);
+}
+
+void BenchWorker::startLoad()
+{
+    m_lastTick = monotonicNanos();
+    m_tickTimer->start(kTickMs);
+}
+
+void BenchWorker::stopLoad()
+{
+    m_tickTimer->stop();
+}
+
+void BenchWorker::tick()
+{
+    const qint64 now = monotonicNanos();
+    const double seconds = double(now - m_lastTick) / 1e9;
+    m_lastTick = now;
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        double &credit = m_credit[i];
+        credit = qMin(kMaxCredit, credit + m_config.rate * seconds);
+        while (credit >= 1.0) {
+            credit -= 1.0;
+            runOperation(m_clients.at(i), i);
+        }
+    }
+}
+
+void BenchWorker::runOperation(BenchClient *client, int localIndex)
+{
+    if (!client->isReady()) return;
+
+    switch (m_config.workload) {
+    case Workload::Messages:
+        client->sendMessage();
+        break;
+    case Workload::History:
+        if (!client->isBusy()) client->requestHistory();
+        break;
+    case Workload::Upload:
+        if (!client->isBusy()) client->startUpload();
+        break;
+    case Workload::Churn:
+        client->reconnect(nickFor(m_firstClient + localIndex, ++m_generation[localIndex]));
+        break;
+    }
+}
+
+BenchRunner::BenchRunner(const BenchConfig &config, QObject *parent)
+    : QObject(parent)
+    , m_config(config)
+{
+    connect(&m_rssTimer, &QTimer::timeout, this, &BenchRunner::sampleRss);
+}
+
+BenchRunner::~BenchRunner()
+{
+    for (QThread *thread : std::as_const(m_threads)) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+}
+
+void BenchRunner::start()
+{
+    m_serverPid = m_config.serverPid;
+    if (m_serverPid == 0) {
+        // Ищем сервер сами (только Linux)
+        const QStringList pids = QDir("/proc").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        for (const QString &pid : pids) {
+            QFile comm("/proc/" + pid + "/comm");
+            if (comm.open(QIODevice::ReadOnly) && comm.readAll().trimmed() == "MessengerServer") {
+                m_serverPid = pid.toLongLong();
+                break;
+            }
+        }
+    }
+    m_rssStart = m_rssPeak = readServerRss();
+    m_rssTimer.start(1000);
+
+    // Тег прогона в никах — чтобы не столкнуться с клиентами прошлого запуска
+    const QString tag = QString::number(QCoreApplication::applicationPid() % 100000);
+    const int perWorker = m_config.clients / m_config.threads;
+    int first = 0;
+    for (int i = 0; i < m_config.threads; ++i) {
+        const int count = i == m_config.threads - 1 ? m_config.clients - first : perWorker;
+        auto *thread = new QThread;
+        thread->setObjectName(QString("bench-%1").arg(i));
+        auto *worker = new BenchWorker(i, first, count, m_config, &m_stats, tag);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::started, worker, &BenchWorker::connectClients);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        connect(worker, &BenchWorker::connected, this, &BenchRunner::onWorkerConnected);
+        connect(worker, &BenchWorker::seeded, this, &BenchRunner::onWorkerSeeded);
+        m_threads.append(thread);
+        m_workers.append(worker);
+        first += count;
+    }
+
+    progress(QString("Connecting %1 clients on %2 threads to %3:%4 (%5 workload)")
+                 .arg(m_config.clients).arg(m_config.threads).arg(m_config.host).arg(m_config.port)
+                 .arg(BenchConfig::workloadName(m_config.workload)));
+    for (QThread *thread : std::as_const(m_threads))
+        thread->start();
+}
+
+void BenchRunner::onWorkerConnected()
+{
+    if (++m_workersConnected < m_workers.size()) return;
+
+    int ready = 0;
+    for (BenchWorker *worker : std::as_const(m_workers))
+        ready += worker->readyClients();
+    progress(QString("%1 of %2 clients registered").arg(ready).arg(m_config.clients));
+
+    if (m_config.workload == Workload::History && m_config.historySeed > 0) {
+        progress(QString("Seeding %1 messages per client").arg(m_config.historySeed));
+        for (BenchWorker *worker : std::as_const(m_workers))
+            QMetaObject::invokeMethod(worker, &BenchWorker::seedHistory, Qt::QueuedConnection);
+        return;
+    }
+    beginMeasurement();
+}
+
+void BenchRunner::onWorkerSeeded()
+{
+    if (++m_workersSeeded == m_workers.size()) beginMeasurement();
+}
+
+void BenchRunner::beginMeasurement()
+{
+    progress(QString("Measuring for %1 s").arg(m_config.durationSecs));
+    m_stats.measuring.store(true);
+    m_measureStart = monotonicNanos();
+    for (BenchWorker *worker : std::as_const(m_workers))
+        QMetaObject::invokeMethod(worker, &BenchWorker::startLoad, Qt::QueuedConnection);
+
+    QTimer::singleShot(m_config.durationSecs * 1000, this, [this]() {
+        m_measureEnd = monotonicNanos();
+        for (BenchWorker *worker : std::as_const(m_workers))
+            QMetaObject::invokeMethod(worker, &BenchWorker::stopLoad, Qt::QueuedConnection);
+        QTimer::singleShot(kDrainMs, this, &BenchRunner::finish);
+    });
+}
+
+void BenchRunner::finish()
+{
+    m_stats.measuring.store(false);
+    m_rssTimer.stop();
+    m_rssEnd = readServerRss();
+    m_rssPeak = qMax(m_rssPeak, m_rssEnd);
+
+    const QByteArray json = QJsonDocument(report()).toJson(QJsonDocument::Indented);
+    if (m_config.output.isEmpty()) {
+        std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+        std::fflush(stdout);
+    } else {
+        QFile file(m_config.output);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            file.write(json);
+        else
+            progress("Cannot write " + m_config.output);
+    }
+    QCoreApplication::quit();
+}
+
+void BenchRunner::sampleRss()
+{
+    m_rssPeak = qMax(m_rssPeak, readServerRss());
+}
+
+qint64 BenchRunner::readServerRss() const
+{
+    if (m_serverPid == 0) return -1;
+
+    QFile status(QString("/proc/%1/status").arg(m_serverPid));
+    if (!status.open(QIODevice::ReadOnly)) return -1;
+    // "VmRSS:     12345 kB"
+    for (const QByteArray &line : status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+QJsonObject BenchRunner::report() const
+{
+    const double seconds = double(m_measureEnd - m_measureStart) / 1e9;
+    const BenchStats &s = m_stats;
+
+    // Главная цифра каждого сценария: операции в секунду и задержка одной операции
+    quint64 operations = 0;
+    const Histogram *primary = &s.deliveryLatency;
+    switch (m_config.workload) {
+    case Workload::Messages: operations = s.delivered.value(); primary = &s.deliveryLatency; break;
+    case Workload::Churn:    operations = s.joins.value();     primary = &s.joinLatency;     break;
+    case Workload::History:  operations = s.historyReplies.value(); primary = &s.historyLatency; break;
+    case Workload::Upload:   operations = s.uploadsDone.value(); primary = &s.uploadLatency;  break;
+    }
+
+    QJsonObject out;
+    out["workload"] = BenchConfig::workloadName(m_config.workload);
+    out["clients"] = m_config.clients;
+    out["threads"] = m_config.threads;
+    out["rate_per_client"] = m_config.rate;
+    out["duration_s"] = seconds;
+    out["ops_per_sec"] = seconds > 0 ? double(operations) / seconds : 0.0;
+    out["msgs_per_sec"] = seconds > 0 ? double(s.delivered.value()) / seconds : 0.0;
+    out["latency"] = latencyJson(*primary);
+
+    QJsonObject counts;
+    counts["sent"] = double(s.sent.value());
+    counts["delivered"] = double(s.delivered.value());
+    counts["acked"] = double(s.acked.value());
+    counts["rejected"] = double(s.rejected.value());
+    counts["undelivered"] = double(s.undelivered.value());
+    counts["history_replies"] = double(s.historyReplies.value());
+    counts["uploads"] = double(s.uploadsDone.value());
+    counts["upload_bytes"] = double(s.uploadBytes.value());
+    counts["relay_bytes"] = double(s.relayBytes.value());
+    counts["joins"] = double(s.joins.value());
+    counts["connect_failures"] = double(s.connectFailures.value());
+    counts["disconnects"] = double(s.disconnects.value());
+    out["counts"] = counts;
+
+    QJsonObject latencies;
+    latencies["delivery"] = latencyJson(s.deliveryLatency);
+    latencies["ack"] = latencyJson(s.ackLatency);
+    latencies["history"] = latencyJson(s.historyLatency);
+    latencies["upload"] = latencyJson(s.uploadLatency);
+    latencies["join"] = latencyJson(s.joinLatency);
+    out["latencies"] = latencies;
+
+    QJsonObject rss;
+    rss["pid"] = double(m_serverPid);
+    rss["start_kb"] = double(m_rssStart);
+    rss["peak_kb"] = double(m_rssPeak);
+    rss["end_kb"] = double(m_rssEnd);
+    out["server_rss"] = m_rssStart < 0 ? QJsonValue() : QJsonValue(rss);
+
+    // Сравнение с прошлым прогоном на той же машине: изменения в процентах
+    if (!m_config.baseline.isEmpty()) {
+        QFile file(m_config.baseline);
+        if (file.open(QIODevice::ReadOnly)) {
+            const QJsonObject before = QJsonDocument::fromJson(file.readAll()).object();
+            const QJsonObject beforeLatency = before["latency"].toObject();
+            const QJsonObject nowLatency = out["latency"].toObject();
+
+            QJsonObject diff;
+            diff["file"] = m_config.baseline;
+            diff["same_workload"] = before["workload"].toString() == out["workload"].toString();
+            diff["ops_per_sec_change_pct"] = changePercent(out["ops_per_sec"].toDouble(), before["ops_per_sec"].toDouble());
+            for (const char *key : {"p50_us", "p99_us", "p999_us"}) {
+                diff[QString(key).replace("_us", "_change_pct")] =
+                    changePercent(nowLatency[key].toDouble(), beforeLatency[key].toDouble());
+            }
+            if (before["server_rss"].isObject() && rss["peak_kb"].toDouble() > 0) {
+                diff["rss_peak_change_pct"] = changePercent(rss["peak_kb"].toDouble(),
+                                                            before["server_rss"].toObject()["peak_kb"].toDouble());
+            }
+            out["baseline"] = diff;
+        } else {
+            progress("Cannot read baseline " + m_config.baseline);
+        }
+    }
+    return out;
+}
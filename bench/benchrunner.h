@@ -0,0 +1,97 @@
+#ifndef BENCHRUNNER_H
+#define BENCHRUNNER_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include "benchclient.h"
+
+// Часть клиентов со своим event loop. Подключает их порциями, потом по таймеру
+// раздает операции с заданной частотой
+class BenchWorker : public QObject {
+    Q_OBJECT
+public:
+    BenchWorker(int index, int firstClient, int clientCount, const BenchConfig &config,
+                BenchStats *stats, const QString &tag, QObject *parent = nullptr);
+
+    int readyClients() const { return m_readyCount.load(); }
+    int pendingAcks() const { return m_pendingAcks.load(); }
+
+public slots:
+    void connectClients();
+    void seedHistory();
+    void startLoad();
+    void stopLoad();
+
+signals:
+    void connected(int worker);
+    void seeded(int worker);
+
+private slots:
+    void connectNextBatch();
+    void tick();
+
+private:
+    QString nickFor(int client, int generation) const;
+    void runOperation(BenchClient *client, int localIndex);
+
+    int m_index;
+    int m_firstClient;
+    int m_clientCount;
+    const BenchConfig &m_config;
+    BenchStats *m_stats;
+    QString m_tag;
+
+    QList<BenchClient*> m_clients;
+    QList<double> m_credit;      // накопленные операции на клиента
+    QList<int> m_generation;     // для churn: сколько раз клиент уже перезаходил
+    int m_nextToConnect = 0;
+    int m_settled = 0;           // подключились или не смогли
+    std::atomic<int> m_readyCount{0};
+    std::atomic<int> m_pendingAcks{0};
+
+    QTimer *m_connectTimer = nullptr;
+    QTimer *m_tickTimer = nullptr;
+    qint64 m_lastTick = 0;
+    int m_seedLeft = 0;
+};
+
+// Весь прогон: подключение -> (подготовка истории) -> замер -> отчет в JSON
+class BenchRunner : public QObject {
+    Q_OBJECT
+public:
+    explicit BenchRunner(const BenchConfig &config, QObject *parent = nullptr);
+    ~BenchRunner();
+
+    void start();
+
+private slots:
+    void onWorkerConnected();
+    void onWorkerSeeded();
+    void sampleRss();
+
+private:
+    void beginMeasurement();
+    void finish();
+    QJsonObject report() const;
+    qint64 readServerRss() const;
+
+    BenchConfig m_config;
+    BenchStats m_stats;
+    QList<QThread*> m_threads;
+    QList<BenchWorker*> m_workers;
+    int m_workersConnected = 0;
+    int m_workersSeeded = 0;
+
+    qint64 m_serverPid = 0;
+    qint64 m_rssStart = 0;
+    qint64 m_rssPeak = 0;
+    qint64 m_rssEnd = 0;
+    QTimer m_rssTimer;
+    qint64 m_measureStart = 0;
+    qint64 m_measureEnd = 0;
+};
+
+#endif
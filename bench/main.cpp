@@ -0,0 +1,14 @@
+#include <QCoreApplication>
+#include <QTimer>
+#include "benchconfig.h"
+#include "benchrunner.h"
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    const BenchConfig config = BenchConfig::fromArguments(a.arguments());
+    BenchRunner runner(config);
+    QTimer::singleShot(0, &runner, &BenchRunner::start);
+
+    return a.exec();
+}
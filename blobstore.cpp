@@ -0,0 +1,199 @@
+#include "blobstore.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace {
+// Больше — сжатая копия не окупает себя, шлем как есть
+constexpr qint64 kMaxPackedSize = 8 * 1024 * 1024;
+constexpr qsizetype kMagicSize = 16;
+}
+
+BlobStore::BlobStore()
+{
+    // Сжатие — не срочная работа: одного потока хватает, и он не отнимает ядра у шардов
+    m_packer.setMaxThreadCount(1);
+}
+
+BlobStore::~BlobStore()
+{
+    m_packer.clear();
+    m_packer.waitForDone();
+}
+
+void BlobStore::setRoot(const QString &root)
+{
+    m_root = root;
+    QDir().mkpath(m_root);
+}
+
+QString BlobStore::path(const QByteArray &hash) const
+{
+    // Раскладываем по подкаталогам по первым двум символам, чтобы не держать миллион файлов в одном
+    return m_root + "/" + QString::fromLatin1(hash.left(2)) + "/" + QString::fromLatin1(hash);
+}
+
+qint64 BlobStore::size(const QByteArray &hash) const
+{
+    return QFileInfo(path(hash)).size();
+}
+
+bool BlobStore::isValidHash(QByteArrayView hash)
+{
+    if (hash.size() != 64) return false;
+    for (char c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+bool BlobStore::adopt(const QString &sourcePath, const QByteArray &hash)
+{
+    if (!isValidHash(hash)) return false;
+
+    QMutexLocker locker(&m_mutex);
+    const QString target = path(hash);
+    if (QFile::exists(target)) {
+        // Такой файл уже есть — копия не нужна
+        QFile::remove(sourcePath);
+    } else {
+        QDir().mkpath(QFileInfo(target).path());
+        // Спул может быть на другом диске, тогда rename не сработает — копируем
+        if (!QFile::rename(sourcePath, target)) {
+            if (!QFile::copy(sourcePath, target)) return false;
+            QFile::remove(sourcePath);
+        }
+    }
+    retainLocked(hash);
+    return true;
+}
+
+QByteArray BlobStore::store(QByteArrayView data)
+{
+    const QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+
+    QMutexLocker locker(&m_mutex);
+    const QString target = path(hash);
+    if (!QFile::exists(target)) {
+        QDir().mkpath(QFileInfo(target).path());
+        // QSaveFile: либо файл целиком, либо его нет
+        QSaveFile file(target);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data.data(), data.size()) != data.size() || !file.commit())
+            return QByteArray();
+    }
+    retainLocked(hash);
+    return hash;
+}
+
+void BlobStore::retainLocked(const QByteArray &hash)
+{
+    ++m_refs[hash];
+}
+
+QString BlobStore::packedPath(const QByteArray &hash, Compression::Algorithm algorithm) const
+{
+    return path(hash) + "." + Compression::name(algorithm);
+}
+
+QString BlobStore::packed(const QByteArray &hash, Compression::Algorithm algorithm, qint64 &packedSize)
+{
+    const QString target = packedPath(hash, algorithm);
+    const QFileInfo info(target);
+    if (info.exists()) {
+        packedSize = info.size();
+        return target;
+    }
+
+    // Первый запрос отдаем несжатым, следующие получат готовую копию
+    QMutexLocker locker(&m_mutex);
+    if (m_unpackable.contains(target) || m_packing.contains(target)) return QString();
+    m_packing.insert(target);
+    m_packer.start([this, hash, algorithm, target]() { pack(hash, algorithm, target); });
+    return QString();
+}
+
+// Фоновый поток. Сжимаем без блокировки, под ней только проверяем, что файл никто не удалил
+void BlobStore::pack(const QByteArray &hash, Compression::Algorithm algorithm, const QString &target)
+{
+    MappedBlob blob;
+    const bool opened = blob.open(path(hash));
+    QByteArray compressed;
+    if (opened) {
+        const QByteArrayView data = blob.data();
+        if (data.size() <= kMaxPackedSize && !Compression::isPrecompressed(data.first(qMin(kMagicSize, data.size()))))
+            compressed = Compression::compress(algorithm, data);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_packing.remove(target);
+    if (compressed.isEmpty()) {
+        if (opened) m_unpackable.insert(target);
+        return;
+    }
+    // Пока сжимали, последнее сообщение с файлом могли удалить — копия не нужна
+    if (!QFile::exists(path(hash))) return;
+
+    QSaveFile file(target);
+    if (file.open(QIODevice::WriteOnly) && file.write(compressed) == compressed.size())
+        file.commit();
+}
+
+void BlobStore::release(const QByteArray &hash)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_refs.find(hash);
+    if (it == m_refs.end()) return;
+    if (--it.value() > 0) return;
+
+    m_refs.erase(it);
+    QFile::remove(path(hash));
+    for (Compression::Algorithm algorithm : {Compression::Algorithm::Deflate, Compression::Algorithm::Zstd}) {
+        const QString packedFile = packedPath(hash, algorithm);
+        QFile::remove(packedFile);
+        m_unpackable.remove(packedFile);
+    }
+}
+
+int BlobStore::refCount(const QByteArray &hash) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_refs.value(hash);
+}
+
+void BlobStore::loadRefCounts(const QHash<QByteArray, int> &counts)
+{
+    QMutexLocker locker(&m_mutex);
+    m_refs = counts;
+}
+
+int BlobStore::removeUnreferenced()
+{
+    QMutexLocker locker(&m_mutex);
+    int removed = 0;
+    QDirIterator it(m_root, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QFileInfo info = it.nextFileInfo();
+        // Сжатые копии (<hash>.zstd) живут, пока жив сам файл
+        if (!m_refs.contains(info.fileName().section('.', 0, 0).toLatin1()) && QFile::remove(info.absoluteFilePath()))
+            ++removed;
+    }
+    return removed;
+}
+
+MappedBlob::~MappedBlob()
+{
+    if (m_data) m_file.unmap(m_data);
+}
+
+bool MappedBlob::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    m_size = m_file.size();
+    if (m_size == 0) return true; // пустой файл отобразить нельзя, да и незачем
+    m_data = m_file.map(0, m_size);
+    return m_data != nullptr;
+}
@@ -0,0 +1,77 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include "compression.h"
+
+// Вложения на диске: имя файла — SHA-256 содержимого (hex), одинаковые файлы лежат один раз.
+// Сколько сообщений ссылается на файл, считаем в памяти; источник правды — messages.blob_hash.
+// Общее на все шарды и поток записи в БД.
+class BlobStore {
+public:
+    BlobStore();
+    ~BlobStore();
+
+    // Вызывать до старта потоков
+    void setRoot(const QString &root);
+
+    QString path(const QByteArray &hash) const;
+    qint64 size(const QByteArray &hash) const;
+
+    // Готовый файл переезжает в хранилище (rename, без копирования), если такого еще нет.
+    // Оба способа сразу берут ссылку — отпустить через release(), если сообщение не сохранилось
+    bool adopt(const QString &sourcePath, const QByteArray &hash);
+    // Файл, пришедший целиком в памяти. Возвращает hash или пусто при ошибке
+    QByteArray store(QByteArrayView data);
+
+    // Сжатая копия для клиентов со сжатием: считается один раз на файл и алгоритм и лежит рядом
+    // с ним (<hash>.zstd, <hash>.deflate). Не блокирует: если копии еще нет, она ставится в очередь
+    // фонового потока, а сейчас возвращается пусто. Пусто — слать как есть (в том числе если файл
+    // уже сжат, слишком большой или почти не ужался)
+    QString packed(const QByteArray &hash, Compression::Algorithm algorithm, qint64 &packedSize);
+
+    void release(const QByteArray &hash);
+    int refCount(const QByteArray &hash) const;
+
+    // При старте: счетчики из БД, файлы без ссылок (остатки после падения) удаляем
+    void loadRefCounts(const QHash<QByteArray, int> &counts);
+    int removeUnreferenced();
+
+    static bool isValidHash(QByteArrayView hash);
+
+private:
+    void retainLocked(const QByteArray &hash);
+    QString packedPath(const QByteArray &hash, Compression::Algorithm algorithm) const;
+    void pack(const QByteArray &hash, Compression::Algorithm algorithm, const QString &target);
+
+    mutable QMutex m_mutex;
+    QString m_root;
+    QHash<QByteArray, int> m_refs;
+    QSet<QString> m_unpackable; // пути сжатых копий, которые делать не стоит
+    QSet<QString> m_packing;    // уже в очереди на сжатие
+    QThreadPool m_packer;       // последним: при удалении дожидается задач, пока остальное живо
+};
+
+// Файл хранилища, отображенный в память: сокету отдаем куски прямо из отображения,
+// целиком в куче он не лежит никогда
+class MappedBlob {
+public:
+    ~MappedBlob();
+
+    bool open(const QString &path);
+    QByteArrayView data() const { return QByteArrayView(reinterpret_cast<const char*>(m_data), m_size); }
+
+private:
+    QFile m_file;
+    uchar *m_data = nullptr;
+    qint64 m_size = 0;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "compression.h"
+#include <QFileInfo>
+#include <QSet>
+
+#ifdef MESSENGER_HAVE_ZSTD
+#include <memory>
+#include <zstd.h>
+#endif
+
+namespace {
+constexpr int kDeflateLevel = 6;
+constexpr int kZstdLevel = 3;
+constexpr qsizetype kQCompressHeader = 4; // qCompress кладет впереди длину исходных данных
+
+bool startsWith(QByteArrayView data, QByteArrayView prefix, qsizetype at = 0)
+{
+    return data.size() >= at + prefix.size() && data.sliced(at, prefix.size()) == prefix;
+}
+
+// Заголовок кадра MPEG-аудио без ID3 (mp3, mp2) или AAC в ADTS. Одних 11 бит синхронизации мало:
+// под них попадает BOM UTF-16LE (FF FE) и любой файл, начинающийся с FFEx. FF FE по полям — MPEG-1
+// Layer I, который на деле не встречается, поэтому Layer I не считаем вовсе
+bool isAudioFrameHeader(QByteArrayView head)
+{
+    if (head.size() < 4 || quint8(head[0]) != 0xFF) return false;
+    const quint8 b1 = quint8(head[1]);
+    const quint8 b2 = quint8(head[2]);
+
+    // ADTS: 12 бит синхронизации, слой 00; частота 13..15 зарезервирована
+    if ((b1 & 0xF6) == 0xF0) return ((b2 >> 2) & 0x0F) < 13;
+
+    if ((b1 & 0xE0) != 0xE0) return false;
+    const int version = (b1 >> 3) & 0x03; // 01 — зарезервировано
+    const int layer = (b1 >> 1) & 0x03;   // 01 — III, 10 — II, 11 — I, 00 — зарезервировано
+    const int bitrate = b2 >> 4;          // 1111 — недопустимо
+    const int sampling = (b2 >> 2) & 0x03; // 11 — зарезервировано
+    return version != 1 && (layer == 1 || layer == 2) && bitrate != 0x0F && sampling != 3;
+}
+}
+
+namespace Compression {
+
+quint32 available()
+{
+#ifdef MESSENGER_HAVE_ZSTD
+    return bit(Algorithm::Deflate) | bit(Algorithm::Zstd);
+#else
+    return bit(Algorithm::Deflate);
+#endif
+}
+
+Algorithm negotiate(quint32 clientMask, quint32 allowedMask)
+{
+    const quint32 common = clientMask & allowedMask & available();
+    if (common & bit(Algorithm::Zstd)) return Algorithm::Zstd;
+    if (common & bit(Algorithm::Deflate)) return Algorithm::Deflate;
+    return Algorithm::None;
+}
+
+QString name(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Algorithm::Deflate: return "deflate";
+    case Algorithm::Zstd: return "zstd";
+    case Algorithm::None: break;
+    }
+    return "none";
+}
+
+QByteArray compress(Algorithm algorithm, QByteArrayView data)
+{
+    QByteArray out;
+    switch (algorithm) {
+    case Algorithm::Deflate:
+        out = qCompress(reinterpret_cast<const uchar*>(data.data()), data.size(), kDeflateLevel);
+        if (out.size() > kQCompressHeader) out.remove(0, kQCompressHeader);
+        break;
+
+    case Algorithm::Zstd: {
+#ifdef MESSENGER_HAVE_ZSTD
+        // Контекст на поток: не выделять его заново на каждый кадр
+        thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        out.resize(qsizetype(ZSTD_compressBound(size_t(data.size()))));
+        const size_t written = ZSTD_compressCCtx(context.get(), out.data(), size_t(out.size()),
+                                                 data.data(), size_t(data.size()), kZstdLevel);
+        if (ZSTD_isError(written)) return QByteArray();
+        out.resize(qsizetype(written));
+#endif
+        break;
+    }
+
+    case Algorithm::None:
+        return QByteArray();
+    }
+
+    if (out.isEmpty() || out.size() > data.size() - data.size() / 16) return QByteArray();
+    return out;
+}
+
+bool isPrecompressed(QByteArrayView head)
+{
+    static const QByteArrayView prefixes[] = {
+        "\x89PNG", "\xFF\xD8\xFF", "GIF8",                   // картинки
+        "PK\x03\x04", "\x1F\x8B", "BZh", "\xFD" "7zXZ",      // zip (и docx, apk...), gzip, bzip2, xz
+        "7z\xBC\xAF\x27\x1C", "Rar!\x1A\x07", "\x28\xB5\x2F\xFD", // 7z, rar, zstd
+        "ID3", "OggS", "fLaC", "\x1A\x45\xDF\xA3"            // mp3, ogg/opus, flac, mkv/webm
+    };
+    for (QByteArrayView prefix : prefixes) {
+        if (startsWith(head, prefix)) return true;
+    }
+
+    // RIFF....WEBP, ....ftyp (mp4, mov, heic, avif), mp3 без ID3 и aac
+    if (startsWith(head, "RIFF") && startsWith(head, "WEBP", 8)) return true;
+    if (startsWith(head, "ftyp", 4)) return true;
+    return isAudioFrameHeader(head);
+}
+
+bool isPrecompressedName(const QString &fileName)
+{
+    static const QSet<QString> extensions{
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "heif", "avif",
+        "mp3", "m4a", "aac", "ogg", "opus", "flac", "mp4", "m4v", "mov", "mkv", "webm", "avi",
+        "zip", "gz", "tgz", "bz2", "xz", "7z", "rar", "zst", "apk", "jar", "docx", "xlsx", "pptx"
+    };
+    return extensions.contains(QFileInfo(fileName).suffix().toLower());
+}
+
+}
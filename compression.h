@@ -0,0 +1,35 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+
+// Сжатие исходящих данных для клиентов, которые договорились о нем при входе (кадр Hello).
+// zstd есть, только если сервер собран с libzstd (MESSENGER_HAVE_ZSTD), deflate — всегда.
+namespace Compression {
+
+enum class Algorithm : quint8 {
+    None    = 0,
+    Deflate = 1, // поток zlib (RFC 1950), как у qCompress, только без его 4 байт длины
+    Zstd    = 2  // один кадр zstd
+};
+
+inline constexpr quint32 bit(Algorithm algorithm) { return 1u << quint32(algorithm); }
+
+// Алгоритмы, собранные в этот сервер (маска из bit())
+quint32 available();
+// Лучший из тех, что умеют обе стороны и разрешены настройками
+Algorithm negotiate(quint32 clientMask, quint32 allowedMask);
+QString name(Algorithm algorithm);
+
+// Сжатые данные или пусто, если не вышло или выигрыш меньше 1/16 — тогда шлем как есть
+QByteArray compress(Algorithm algorithm, QByteArrayView data);
+
+// Уже сжатые форматы (картинки, видео, архивы) — по первым байтам и по расширению
+bool isPrecompressed(QByteArrayView head);
+bool isPrecompressedName(const QString &fileName);
+
+}
+
+#endif
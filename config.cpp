@@ -0,0 +1,194 @@
+#include "config.h"
+#include "compression.h"
+#include <QCommandLineParser>
+#include <QThread>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Опечатка в значении не должна молча превращаться в значение по умолчанию — выходим, как и process()
+[[noreturn]] void rejectValue(const QCommandLineOption &option, const QString &value, const char *reason = "Unknown value")
+{
+    std::fprintf(stderr, "%s \"%s\" for --%s\n", reason, qPrintable(value), qPrintable(option.names().constFirst()));
+    std::exit(1);
+}
+
+}
+
+ServerConfig ServerConfig::fromArguments(const QStringList &arguments)
+{
+    ServerConfig config;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Messenger server");
+    parser.addHelpOption();
+
+    QCommandLineOption portOption("port", "TCP port to listen on.", "port", QString::number(config.port));
+    QCommandLineOption threadsOption("threads", "Number of worker event loops (0 = number of cores).", "count", "0");
+    QCommandLineOption batchOption("db-batch", "Max messages per write batch.", "count", QString::number(config.dbBatchSize));
+    QCommandLineOption flushOption("db-flush-ms", "Max time a message waits before being written.", "ms",
+                                   QString::number(config.dbFlushIntervalMs));
+    QCommandLineOption queueOption("db-queue", "Max messages waiting to be written.", "count",
+                                   QString::number(config.dbQueueCapacity));
+    parser.addOption(portOption);
+    parser.addOption(threadsOption);
+    parser.addOption(batchOption);
+    parser.addOption(flushOption);
+    QCommandLineOption historyOption("history-cache", "Conversations kept in the in-memory history cache.", "count",
+                                     QString::number(config.historyCacheConversations));
+    QCommandLineOption blobOption("blob-dir", "Directory for file attachments.", "path", config.blobDir);
+    parser.addOption(queueOption);
+    parser.addOption(historyOption);
+    parser.addOption(blobOption);
+    QCommandLineOption highOption("out-high-kb", "Outbound queue size at which a client counts as slow.", "kb",
+                                  QString::number(config.outHighWatermark / 1024));
+    QCommandLineOption lowOption("out-low-kb", "Outbound queue size at which a slow client recovers.", "kb",
+                                 QString::number(config.outLowWatermark / 1024));
+    QCommandLineOption hardOption("out-hard-kb", "Outbound queue size at which a client is disconnected.", "kb",
+                                  QString::number(config.outHardLimit / 1024));
+    QCommandLineOption policyOption("slow-policy", "Slow client handling: drop-presence, defer-files or disconnect.",
+                                    "policy", "defer-files");
+    parser.addOption(highOption);
+    parser.addOption(lowOption);
+    parser.addOption(hardOption);
+    parser.addOption(policyOption);
+    QCommandLineOption compressionOption("compression", "Compression offered to clients: auto, zstd, deflate or off.",
+                                         "algorithm", "auto");
+    QCommandLineOption compressMinOption("compress-min", "Smallest payload worth compressing.", "bytes",
+                                         QString::number(config.compressionMinSize));
+    parser.addOption(compressionOption);
+    parser.addOption(compressMinOption);
+    QCommandLineOption registerTimeoutOption("register-timeout", "Seconds a new connection has to send a nickname (0 = no limit).",
+                                             "seconds", QString::number(config.registerTimeoutMs / 1000));
+    QCommandLineOption pingIntervalOption("ping-interval", "Ping binary clients silent for this long (0 = off).", "seconds",
+                                          QString::number(config.pingIntervalMs / 1000));
+    QCommandLineOption pingTimeoutOption("ping-timeout", "Disconnect a client that does not answer a ping in time.", "seconds",
+                                         QString::number(config.pingTimeoutMs / 1000));
+    QCommandLineOption idleTimeoutOption("idle-timeout", "Disconnect a binary client that neither sends nor reads for this long (0 = never).",
+                                         "seconds", QString::number(config.idleTimeoutMs / 1000));
+    parser.addOption(registerTimeoutOption);
+    parser.addOption(pingIntervalOption);
+    parser.addOption(pingTimeoutOption);
+    parser.addOption(idleTimeoutOption);
+    QCommandLineOption logLevelOption("log-level", "Minimum log level: debug, info, warning or error.", "level", "info");
+    QCommandLineOption logFileOption("log-file", "Write the log to this file instead of stderr.", "path");
+    QCommandLineOption logSizeOption("log-max-mb", "Rotate the log file at this size.", "mb",
+                                     QString::number(config.logMaxFileSize / (1024 * 1024)));
+    QCommandLineOption logFilesOption("log-files", "Rotated log files to keep.", "count", QString::number(config.logMaxFiles));
+    QCommandLineOption logBufferOption("log-buffer", "Log records buffered before new ones are dropped.", "count",
+                                       QString::number(config.logBufferSize));
+    parser.addOption(logLevelOption);
+    parser.addOption(logFileOption);
+    parser.addOption(logSizeOption);
+    parser.addOption(logFilesOption);
+    parser.addOption(logBufferOption);
+    QCommandLineOption storageOption("storage", "Message storage: postgres, memory or log.", "engine", "postgres");
+    QCommandLineOption dbHostOption("db-host", "PostgreSQL host.", "host", config.dbHost);
+    QCommandLineOption dbNameOption("db-name", "PostgreSQL database.", "name", config.dbName);
+    QCommandLineOption dbUserOption("db-user", "PostgreSQL user.", "user", config.dbUser);
+    QCommandLineOption dbPasswordOption("db-password", "PostgreSQL password.", "password");
+    QCommandLineOption storeDirOption("store-dir", "Directory of the message log (--storage log).", "path", config.storeDir);
+    QCommandLineOption segmentOption("segment-mb", "Size at which the message log starts a new segment.", "mb",
+                                     QString::number(config.storeSegmentSize / (1024 * 1024)));
+    QCommandLineOption retentionOption("retention-days", "Drop logged messages older than this (0 = keep all).", "days",
+                                       QString::number(config.storeRetentionDays));
+    QCommandLineOption openAttemptsOption("store-open-attempts",
+                                          "Attempts to open message storage at startup before exiting (0 = keep trying).",
+                                          "count", QString::number(config.storeOpenAttempts));
+    parser.addOption(storageOption);
+    parser.addOption(dbHostOption);
+    parser.addOption(dbNameOption);
+    parser.addOption(dbUserOption);
+    parser.addOption(dbPasswordOption);
+    parser.addOption(storeDirOption);
+    parser.addOption(segmentOption);
+    parser.addOption(retentionOption);
+    parser.addOption(openAttemptsOption);
+    QCommandLineOption statsOption("stats-port", "Local port for Prometheus metrics (0 = off).", "port",
+                                   QString::number(config.statsPort));
+    QCommandLineOption adminOption("admin", "Nickname allowed to use /stats (can be repeated).", "nick");
+    parser.addOption(statsOption);
+    parser.addOption(adminOption);
+    parser.process(arguments);
+
+    config.port = parser.value(portOption).toUShort();
+    config.workerThreads = parser.value(threadsOption).toInt();
+    if (config.workerThreads <= 0)
+        config.workerThreads = qMax(1, QThread::idealThreadCount());
+
+    const QString storage = parser.value(storageOption);
+    if (storage == "memory")
+        config.storage = StorageEngine::Memory;
+    else if (storage == "log")
+        config.storage = StorageEngine::Log;
+    else if (storage != "postgres")
+        rejectValue(storageOption, storage);
+    config.dbHost = parser.value(dbHostOption);
+    config.dbName = parser.value(dbNameOption);
+    config.dbUser = parser.value(dbUserOption);
+    if (parser.isSet(dbPasswordOption)) config.dbPassword = parser.value(dbPasswordOption);
+    config.storeDir = parser.value(storeDirOption);
+    // Смещения в индексе 32-битные — сегмент не больше гигабайта
+    config.storeSegmentSize = qBound(1LL, parser.value(segmentOption).toLongLong(), 1024LL) * 1024 * 1024;
+    config.storeRetentionDays = qMax(0, parser.value(retentionOption).toInt());
+    config.storeOpenAttempts = qMax(0, parser.value(openAttemptsOption).toInt());
+
+    config.dbBatchSize = qMax(1, parser.value(batchOption).toInt());
+    config.dbFlushIntervalMs = qMax(1, parser.value(flushOption).toInt());
+    config.dbQueueCapacity = qMax(1, parser.value(queueOption).toInt());
+    config.historyCacheConversations = qMax(1, parser.value(historyOption).toInt());
+    config.blobDir = parser.value(blobOption);
+
+    config.outHighWatermark = qMax(64LL, parser.value(highOption).toLongLong()) * 1024;
+    config.outLowWatermark = qBound(0LL, parser.value(lowOption).toLongLong() * 1024, config.outHighWatermark);
+    config.outHardLimit = qMax(config.outHighWatermark, parser.value(hardOption).toLongLong() * 1024);
+
+    config.statsPort = parser.value(statsOption).toUShort();
+    config.adminNicks = parser.values(adminOption);
+
+    const QStringList levels{"debug", "info", "warning", "error"};
+    const int logLevel = int(levels.indexOf(parser.value(logLevelOption).toLower()));
+    if (logLevel < 0) rejectValue(logLevelOption, parser.value(logLevelOption));
+    config.logLevel = logLevel;
+    config.logFile = parser.value(logFileOption);
+    config.logMaxFileSize = qMax(1LL, parser.value(logSizeOption).toLongLong()) * 1024 * 1024;
+    config.logMaxFiles = qMax(1, parser.value(logFilesOption).toInt());
+    config.logBufferSize = qMax(64, parser.value(logBufferOption).toInt());
+
+    const QString compression = parser.value(compressionOption);
+    if (compression == "zstd") {
+        // Без libzstd договориться было бы не о чем — клиенты молча остались бы без сжатия
+        if (!(Compression::available() & Compression::bit(Compression::Algorithm::Zstd)))
+            rejectValue(compressionOption, compression, "Built without libzstd, unsupported value");
+        config.compressionAlgorithms = Compression::bit(Compression::Algorithm::Zstd);
+    }
+    else if (compression == "deflate")
+        config.compressionAlgorithms = Compression::bit(Compression::Algorithm::Deflate);
+    else if (compression == "off")
+        config.compressionAlgorithms = 0;
+    else if (compression != "auto")
+        rejectValue(compressionOption, compression);
+    config.compressionMinSize = qMax(64, parser.value(compressMinOption).toInt());
+
+    // Сроки соединения в секундах, больше суток смысла не имеют
+    const auto seconds = [&parser](const QCommandLineOption &option) {
+        return qBound(0, parser.value(option).toInt(), 24 * 60 * 60) * 1000;
+    };
+    config.registerTimeoutMs = seconds(registerTimeoutOption);
+    config.pingIntervalMs = seconds(pingIntervalOption);
+    config.pingTimeoutMs = qMax(1000, seconds(pingTimeoutOption));
+    config.idleTimeoutMs = seconds(idleTimeoutOption);
+
+    const QString policy = parser.value(policyOption);
+    if (policy == "drop-presence")
+        config.slowConsumerPolicy = SlowConsumerPolicy::DropPresence;
+    else if (policy == "disconnect")
+        config.slowConsumerPolicy = SlowConsumerPolicy::Disconnect;
+    else if (policy == "defer-files")
+        config.slowConsumerPolicy = SlowConsumerPolicy::DeferFiles;
+    else
+        rejectValue(policyOption, policy);
+
+    return config;
+}
@@ -0,0 +1,82 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <QStringList>
+
+// Что делать с клиентом, который не успевает читать. Каждый следующий уровень включает предыдущие
+enum class SlowConsumerPolicy {
+    DropPresence, // пропускать изменения списка пользователей, потом прислать его целиком
+    DeferFiles,   // плюс не пересылать файлы на лету — отдать целиком из хранилища, когда разгребется
+    Disconnect    // плюс отключать сразу по верхней отметке
+};
+
+// Где хранить сообщения
+enum class StorageEngine {
+    Postgres, // как раньше, общий сервер БД
+    Memory,   // только в памяти — для тестов и нагрузочных прогонов
+    Log       // свой журнал на локальном диске, без сервера БД
+};
+
+// Настройки запуска, собираются из аргументов командной строки
+struct ServerConfig {
+    quint16 port = 1234;
+    int workerThreads = 0; // 0 — по числу ядер
+
+    // Хранилище сообщений
+    StorageEngine storage = StorageEngine::Postgres;
+    QString dbHost = "localhost";
+    QString dbName = "messenger_db";
+    QString dbUser = "postgres";
+    QString dbPassword = "MY_RRRITK2";
+    // Журнал: каталог, размер сегмента, сколько дней хранить (0 — всегда)
+    QString storeDir = "messages";
+    qint64 storeSegmentSize = 64 * 1024 * 1024;
+    int storeRetentionDays = 0;
+    // Сколько раз пробовать открыть хранилище при запуске, прежде чем выйти (0 — пока не остановят)
+    int storeOpenAttempts = 20;
+
+    // Отложенная запись в хранилище
+    int dbBatchSize = 256;
+    int dbFlushIntervalMs = 20;
+    int dbQueueCapacity = 50000;
+
+    // Сколько переписок держать в памяти
+    int historyCacheConversations = 10000;
+
+    // Куда складывать вложения (имя файла — его SHA-256)
+    QString blobDir = "blobs";
+
+    // Исходящая очередь соединения: выше high — клиент "медленный", ниже low — снова нормальный.
+    // Больше hard не копим ни при какой политике
+    qint64 outHighWatermark = 1024 * 1024;
+    qint64 outLowWatermark = 256 * 1024;
+    qint64 outHardLimit = 8 * 1024 * 1024;
+    SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::DeferFiles;
+
+    // Сжатие для клиентов, которые его попросили: разрешенные алгоритмы (биты Compression::bit)
+    // и размер, меньше которого кадры идут как есть
+    quint32 compressionAlgorithms = ~0u;
+    int compressionMinSize = 512;
+
+    // Сроки соединения, мс (0 — не проверять): ник после подключения, пульс бинарных клиентов
+    // (Ping после такого молчания и сколько ждать Pong) и простой — бинарный клиент ничего не шлет и не забирает
+    int registerTimeoutMs = 10 * 1000;
+    int pingIntervalMs = 30 * 1000;
+    int pingTimeoutMs = 15 * 1000;
+    int idleTimeoutMs = 30 * 60 * 1000;
+
+    // Лог: уровень 0..3 (debug, info, warning, error), пустой файл — stderr
+    int logLevel = 1;
+    QString logFile;
+    qint64 logMaxFileSize = 64 * 1024 * 1024;
+    int logMaxFiles = 5;
+    int logBufferSize = 8192; // записей в кольце
+
+    // Метрики Prometheus на 127.0.0.1, 0 — выключено; кому доступна команда /stats
+    quint16 statsPort = 9100;
+    QStringList adminNicks;
+
+    static ServerConfig fromArguments(const QStringList &arguments);
+};
+
+#endif
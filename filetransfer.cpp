@@ -0,0 +1,130 @@
+#include "filetransfer.h"
+#include "compression.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSet>
+
+namespace {
+// Spool-файлы, которые сейчас пишутся. Загрузки живут на разных шардах, а каталог общий
+QMutex spoolMutex;
+QSet<QString> activeSpools;
+
+bool claimSpool(const QString &path)
+{
+    QMutexLocker locker(&spoolMutex);
+    if (activeSpools.contains(path)) return false;
+    activeSpools.insert(path);
+    return true;
+}
+
+void releaseSpool(const QString &path)
+{
+    QMutexLocker locker(&spoolMutex);
+    activeSpools.remove(path);
+}
+}
+
+FileUpload::FileUpload(quint64 transferId, const QString &sender, const QString &target,
+                       const QString &fileName, qint64 size)
+    : m_transferId(transferId)
+    , m_sender(sender)
+    , m_target(target)
+    , m_fileName(fileName)
+    , m_size(size)
+    , m_compressible(!Compression::isPrecompressedName(fileName))
+{
+    m_lastActivity.start();
+}
+
+FileUpload::~FileUpload()
+{
+    close();
+    // Не в close(): после нее finishUpload еще переносит файл в хранилище
+    if (m_claimed) releaseSpool(m_file.fileName());
+}
+
+QString FileUpload::spoolKey(const QString &sender, const QString &target,
+                             const QString &fileName, qint64 size)
+{
+    // Одинаковая загрузка (кто, кому, что, сколько) всегда попадает в один и тот же spool-файл
+    const QByteArray id = (sender + '\n' + target + '\n' + fileName + '\n' + QString::number(size)).toUtf8();
+    return QString::fromLatin1(QCryptographicHash::hash(id, QCryptographicHash::Sha1).toHex());
+}
+
+void FileUpload::cleanupSpool(const QString &spoolDir, int maxAgeSecs)
+{
+    const QDateTime border = QDateTime::currentDateTime().addSecs(-maxAgeSecs);
+    const QFileInfoList parts = QDir(spoolDir).entryInfoList({"*.part"}, QDir::Files);
+    for (const QFileInfo &info : parts) {
+        if (info.lastModified() < border)
+            QFile::remove(info.absoluteFilePath());
+    }
+}
+
+FileUpload::OpenStatus FileUpload::open(const QString &spoolDir, bool resume)
+{
+    QDir().mkpath(spoolDir);
+    m_file.setFileName(spoolDir + "/" + spoolKey(m_sender, m_target, m_fileName, m_size) + ".part");
+
+    // Две одновременные одинаковые загрузки писали бы в один файл вперемешку
+    if (!claimSpool(m_file.fileName())) return OpenStatus::Busy;
+    m_claimed = true;
+
+    const QIODevice::OpenMode mode = resume ? (QIODevice::WriteOnly | QIODevice::Append)
+                                            : (QIODevice::WriteOnly | QIODevice::Truncate);
+    if (!m_file.open(mode)) return OpenStatus::Error;
+
+    m_received = m_file.size();
+    if (m_received > m_size) {
+        // Хвост от чего-то другого — начинаем заново
+        m_file.resize(0);
+        m_received = 0;
+    }
+
+    // Докачка: то, что уже лежит в спуле, тоже должно попасть в хеш
+    m_hash.reset();
+    if (m_received > 0) {
+        QFile reader(m_file.fileName());
+        if (!reader.open(QIODevice::ReadOnly)) return OpenStatus::Error;
+        if (Compression::isPrecompressed(reader.peek(16))) m_compressible = false;
+        if (!m_hash.addData(&reader)) return OpenStatus::Error;
+    }
+    m_resumedFrom = m_received;
+    return OpenStatus::Ok;
+}
+
+qint64 FileUpload::append(QByteArrayView chunk)
+{
+    const qint64 take = qMin<qint64>(chunk.size(), m_size - m_received);
+    if (take <= 0) return 0;
+
+    if (m_file.write(chunk.data(), take) != take) return -1;
+    if (m_received == 0 && Compression::isPrecompressed(chunk.first(take))) m_compressible = false;
+    m_hash.addData(chunk.first(take));
+    m_received += take;
+    m_lastActivity.restart();
+    return take;
+}
+
+QByteArray FileUpload::readSpool(qint64 offset, qint64 maxSize)
+{
+    m_file.flush();
+
+    QFile reader(m_file.fileName());
+    if (!reader.open(QIODevice::ReadOnly) || !reader.seek(offset)) return {};
+    return reader.read(qMin(maxSize, m_received - offset));
+}
+
+void FileUpload::close()
+{
+    if (m_file.isOpen()) m_file.close();
+}
+
+void FileUpload::discard()
+{
+    close();
+    m_file.remove();
+}
@@ -0,0 +1,99 @@
+#ifndef FILETRANSFER_H
+#define FILETRANSFER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include "compression.h"
+
+// Лимиты потоковой передачи файлов
+inline constexpr qint64 kMaxFileSize = 512LL * 1024 * 1024;  // BYTEA все равно не любит больше
+inline constexpr qint64 kFileChunkSize = 64 * 1024;          // кусок при пересылке из спула
+inline constexpr qint64 kBlobStreamChunkSize = 4 * 1024 * 1024; // кадр FileChunk, когда файл из хранилища не влез в FileRec
+inline constexpr qint64 kSocketReadBufferSize = 256 * 1024;  // окно памяти на одно соединение
+inline constexpr int kUploadStallTimeoutMs = 30 * 1000;
+inline constexpr quint64 kLegacyTransferId = 0;  // у текстового протокола одна загрузка на соединение
+
+// Входящая загрузка файла: байты сразу уходят во временный spool-файл,
+// в памяти держим только текущий кусок.
+class FileUpload {
+public:
+    // Кому пересылаем. Живые получатели (бинарный протокол) получают куски по мере прихода,
+    // старые текстовые клиенты — весь файл после окончания загрузки.
+    struct Relay {
+        QString nick; // получатель может быть на другом шарде, поэтому по нику
+        quint64 relayId = 0;
+        bool live = false;
+        Compression::Algorithm compression = Compression::Algorithm::None; // как слать куски этому получателю
+    };
+
+    enum class OpenStatus {
+        Ok,
+        Busy,  // тот же spool-файл уже пишет другая загрузка (тот же файл тому же получателю)
+        Error
+    };
+
+    FileUpload(quint64 transferId, const QString &sender, const QString &target,
+               const QString &fileName, qint64 size);
+    ~FileUpload();
+
+    // resume = true: продолжаем с того места, где оборвалась прошлая попытка
+    OpenStatus open(const QString &spoolDir, bool resume);
+
+    // Пишет не больше, чем осталось до конца файла. Возвращает сколько байт взято, -1 при ошибке
+    qint64 append(QByteArrayView chunk);
+
+    // Чтение уже записанного куска спула (для докачки живым получателям)
+    QByteArray readSpool(qint64 offset, qint64 maxSize);
+
+    void close();
+    void discard();
+
+    quint64 transferId() const { return m_transferId; }
+    QString sender() const { return m_sender; }
+    QString target() const { return m_target; }
+    QString fileName() const { return m_fileName; }
+    qint64 size() const { return m_size; }
+    qint64 received() const { return m_received; }
+    qint64 resumedFrom() const { return m_resumedFrom; }
+    bool isComplete() const { return m_received == m_size; }
+    QString spoolPath() const { return m_file.fileName(); }
+    // SHA-256 (hex) всего полученного, считается по ходу загрузки
+    QByteArray contentHash() const { return m_hash.result().toHex(); }
+
+    // Стоит ли сжимать куски для пересылки: не по имени/первым байтам уже сжатый формат
+    // и прошлые куски действительно ужимались
+    bool isCompressible() const { return m_compressible; }
+    void setCompressible(bool compressible) { m_compressible = compressible; }
+
+    bool isStalled() const { return m_lastActivity.hasExpired(kUploadStallTimeoutMs); }
+
+    QList<Relay> &relays() { return m_relays; }
+
+    // Недокачанные файлы, которые так никто и не продолжил
+    static void cleanupSpool(const QString &spoolDir, int maxAgeSecs);
+
+    static QString spoolKey(const QString &sender, const QString &target,
+                            const QString &fileName, qint64 size);
+
+private:
+    quint64 m_transferId;
+    QString m_sender;
+    QString m_target;
+    QString m_fileName;
+    qint64 m_size;
+    qint64 m_received = 0;
+    qint64 m_resumedFrom = 0;
+    bool m_compressible;
+    bool m_claimed = false; // spool-файл занят нами, до удаления загрузки
+    QFile m_file;
+    QCryptographicHash m_hash{QCryptographicHash::Sha256};
+    QElapsedTimer m_lastActivity;
+    QList<Relay> m_relays;
+};
+
+#endif
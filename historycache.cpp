@@ -0,0 +1,175 @@
+#include "historycache.h"
+#include <algorithm>
+#include <utility>
+
+HistoryCache::~HistoryCache()
+{
+    qDeleteAll(m_conversations);
+}
+
+void HistoryCache::setLimits(int maxConversations, int perConversation)
+{
+    m_maxConversations = qMax(1, maxConversations);
+    m_perConversation = qMax(1, perConversation);
+}
+
+QString HistoryCache::conversationKey(const QString &a, const QString &b)
+{
+    // Управляющий \x1f как разделитель — в обычных никах его не бывает
+    return a < b ? a + QChar(0x1f) + b : b + QChar(0x1f) + a;
+}
+
+bool HistoryCache::recent(const QString &key, QList<HistoryEntry> &out)
+{
+    QMutexLocker locker(&m_mutex);
+    Conversation *conversation = m_conversations.value(key);
+    if (!conversation || !conversation->complete) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    unlink(conversation);
+    linkFront(conversation);
+
+    out = conversation->entries;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+quint64 HistoryCache::beginFill()
+{
+    QMutexLocker locker(&m_mutex);
+    const quint64 ticket = ++m_stamp;
+    m_activeFills.insert(ticket);
+    return ticket;
+}
+
+void HistoryCache::cancelFill(quint64 ticket)
+{
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_activeFills.find(ticket);
+    if (it != m_activeFills.end()) m_activeFills.erase(it);
+    forgetFlushed();
+}
+
+void HistoryCache::fill(const QString &key, const QList<HistoryEntry> &entries, quint64 ticket)
+{
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_activeFills.find(ticket);
+    if (it != m_activeFills.end()) m_activeFills.erase(it);
+
+    Conversation *conversation = touch(key);
+    if (!conversation->complete) {
+        // То, что пришло, пока мы ходили в БД, и то, что в нее еще не попало, — поверх результата.
+        // Повторы по id отбрасывает push()
+        const QList<HistoryEntry> arrived = std::exchange(conversation->entries, QList<HistoryEntry>());
+        for (const HistoryEntry &entry : entries) push(conversation, entry);
+        for (const HistoryEntry &entry : arrived) push(conversation, entry);
+        for (const HistoryEntry &entry : m_unflushed.value(key)) push(conversation, entry);
+        conversation->complete = true;
+    }
+    forgetFlushed();
+}
+
+void HistoryCache::append(const QString &key, const HistoryEntry &entry)
+{
+    QMutexLocker locker(&m_mutex);
+    push(touch(key), entry);
+    m_unflushed[key].append(entry);
+}
+
+void HistoryCache::flushed(const QString &key, quint64 id)
+{
+    QMutexLocker locker(&m_mutex);
+    m_flushed.push_back(Flushed{++m_stamp, key, id});
+    forgetFlushed();
+}
+
+// Запрос, начатый до записи, мог ее не увидеть — забываем записанное, только когда таких не осталось
+void HistoryCache::forgetFlushed()
+{
+    while (!m_flushed.empty()
+           && (m_activeFills.empty() || m_flushed.front().stamp < *m_activeFills.begin())) {
+        const Flushed &flushed = m_flushed.front();
+        const auto it = m_unflushed.find(flushed.key);
+        if (it != m_unflushed.end()) {
+            it->removeIf([&flushed](const HistoryEntry &entry) { return entry.id == flushed.id; });
+            if (it->isEmpty()) m_unflushed.erase(it);
+        }
+        m_flushed.pop_front();
+    }
+}
+
+void HistoryCache::invalidate(const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+    Conversation *conversation = m_conversations.take(key);
+    if (!conversation) return;
+    unlink(conversation);
+    delete conversation;
+}
+
+int HistoryCache::conversations() const
+{
+    QMutexLocker locker(&m_mutex);
+    return int(m_conversations.size());
+}
+
+HistoryCache::Conversation *HistoryCache::touch(const QString &key)
+{
+    Conversation *conversation = m_conversations.value(key);
+    if (conversation) {
+        unlink(conversation);
+        linkFront(conversation);
+        return conversation;
+    }
+
+    if (m_conversations.size() >= m_maxConversations && m_tail) {
+        Conversation *victim = m_tail;
+        unlink(victim);
+        m_conversations.remove(victim->key);
+        delete victim;
+    }
+
+    conversation = new Conversation;
+    conversation->key = key;
+    conversation->entries.reserve(m_perConversation);
+    m_conversations.insert(key, conversation);
+    linkFront(conversation);
+    return conversation;
+}
+
+// Почти всегда в конец; шарды могут прислать соседние id не по порядку — тогда вставка
+void HistoryCache::push(Conversation *conversation, const HistoryEntry &entry)
+{
+    QList<HistoryEntry> &entries = conversation->entries;
+    const auto byId = [](const HistoryEntry &e, quint64 id) { return e.id < id; };
+    const auto it = std::lower_bound(entries.begin(), entries.end(), entry.id, byId);
+    if (it != entries.end() && it->id == entry.id) return;
+
+    if (entries.size() < m_perConversation) {
+        entries.insert(it, entry);
+        return;
+    }
+    // Места нет — самое старое уходит; то, что старше его, и не входит
+    if (it == entries.begin()) return;
+    entries.insert(it, entry);
+    entries.removeFirst();
+}
+
+void HistoryCache::unlink(Conversation *conversation)
+{
+    if (conversation->prev) conversation->prev->next = conversation->next;
+    else m_head = conversation->next;
+    if (conversation->next) conversation->next->prev = conversation->prev;
+    else m_tail = conversation->prev;
+    conversation->prev = conversation->next = nullptr;
+}
+
+void HistoryCache::linkFront(Conversation *conversation)
+{
+    conversation->next = m_head;
+    if (m_head) m_head->prev = conversation;
+    m_head = conversation;
+    if (!m_tail) m_tail = conversation;
+}
@@ -0,0 +1,98 @@
+#ifndef HISTORYCACHE_H
+#define HISTORYCACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <set>
+
+inline constexpr int kHistoryPageSize = 50;
+inline constexpr int kMaxHistoryPage = 500;
+
+struct HistoryEntry {
+    quint64 id = 0;
+    QString sender;
+    QString message;   // текст или имя файла
+    QDateTime timestamp;
+    bool isFile = false; // тело файла в кэше не держим, только ссылку на него
+    QByteArray blobHash;  // пусто у старых файлов, которые лежат прямо в БД
+    qint64 fileSize = 0;
+};
+
+// Последние сообщения каждой переписки в памяти: до perConversation штук на разговор по возрастанию id,
+// сами разговоры вытесняются по LRU. Общий на все шарды.
+// id раздаются при постановке в очередь записи, а в кэш сообщения кладут разные шарды — порядок
+// восстанавливаем вставкой. Еще не записанные сообщения помним отдельно от LRU: страница из БД
+// их не содержит, и без этого разговор, вытесненный до записи, заполнился бы с дырой.
+class HistoryCache {
+public:
+    ~HistoryCache();
+
+    // Вызывать до старта шардов
+    void setLimits(int maxConversations, int perConversation);
+
+    // Переписка A с B и B с A — один и тот же ключ
+    static QString conversationKey(const QString &a, const QString &b);
+
+    // true — разговор в кэше целиком, out от старых к новым
+    bool recent(const QString &key, QList<HistoryEntry> &out);
+    // Запрос к БД для fill(): beginFill() до него, потом fill() с результатом или cancelFill()
+    quint64 beginFill();
+    void cancelFill(quint64 ticket);
+    // Результат запроса к БД (от старых к новым); к нему добавляется всё, что еще не записано
+    // или записано уже после beginFill()
+    void fill(const QString &key, const QList<HistoryEntry> &entries, quint64 ticket);
+    // Новое сообщение. Если разговора нет, заводим неполный — он станет полным после fill()
+    void append(const QString &key, const HistoryEntry &entry);
+    // Поток записи: сообщение записано (или потеряно), ждать его из очереди больше не нужно
+    void flushed(const QString &key, quint64 id);
+    // Хранилище выбросило часть разговора — забываем его целиком, следующий запрос заполнит заново
+    void invalidate(const QString &key);
+
+    quint64 hits() const { return m_hits.load(std::memory_order_relaxed); }
+    quint64 misses() const { return m_misses.load(std::memory_order_relaxed); }
+    int conversations() const;
+
+private:
+    struct Conversation {
+        QString key;
+        QList<HistoryEntry> entries; // по возрастанию id
+        bool complete = false;
+        Conversation *prev = nullptr;
+        Conversation *next = nullptr;
+    };
+
+    // Записанное сообщение держим в m_unflushed, пока не закончатся запросы к БД, начатые до записи
+    struct Flushed {
+        quint64 stamp;
+        QString key;
+        quint64 id;
+    };
+
+    Conversation *touch(const QString &key);
+    void push(Conversation *conversation, const HistoryEntry &entry);
+    void forgetFlushed();
+    void unlink(Conversation *conversation);
+    void linkFront(Conversation *conversation);
+
+    mutable QMutex m_mutex;
+    QHash<QString, Conversation*> m_conversations;
+    Conversation *m_head = nullptr; // самый свежий
+    Conversation *m_tail = nullptr; // кандидат на вытеснение
+    int m_maxConversations = 10000;
+    int m_perConversation = kHistoryPageSize;
+
+    QHash<QString, QList<HistoryEntry>> m_unflushed;
+    std::deque<Flushed> m_flushed;
+    std::multiset<quint64> m_activeFills;
+    quint64 m_stamp = 0; // общий счетчик для beginFill() и flushed()
+
+    std::atomic<quint64> m_hits{0};
+    std::atomic<quint64> m_misses{0};
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "listener.h"
+#include "server.h"
+#include "servercontext.h"
+
+Listener::Listener(ServerContext *context, QObject *parent)
+    : QTcpServer(parent)
+    , m_context(context)
+{
+}
+
+void Listener::incomingConnection(qintptr socketDescriptor)
+{
+    Server *shard = m_context->shards.at(m_nextShard);
+    m_nextShard = (m_nextShard + 1) % m_context->shards.size();
+
+    // Сокет создается уже в потоке шарда
+    QMetaObject::invokeMethod(shard, [shard, socketDescriptor]() {
+        shard->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,22 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <QTcpServer>
+
+struct ServerContext;
+
+// Принимает соединения в главном потоке и раздает дескрипторы шардам по кругу
+class Listener : public QTcpServer {
+    Q_OBJECT
+public:
+    explicit Listener(ServerContext *context, QObject *parent = nullptr);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    ServerContext *m_context;
+    int m_nextShard = 0;
+};
+
+#endif
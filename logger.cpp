@@ -0,0 +1,236 @@
+#include "logger.h"
+#include "config.h"
+#include <QDateTime>
+#include <cstdio>
+
+namespace {
+// Сколько записей форматируем в одну запись на диск
+constexpr int kMaxBatch = 1024;
+// Дольше поток логгера не спит, даже если его забыли разбудить
+constexpr int kIdleWaitMs = 50;
+
+const char *levelPrefix(LogLevel level)
+{
+    switch (level) {
+    case LogLevel::Debug:   return " [DBG ] ";
+    case LogLevel::Info:    return " [INFO] ";
+    case LogLevel::Warning: return " [WARN] ";
+    case LogLevel::Error:   return " [ERR!] ";
+    }
+    return " [INFO] ";
+}
+}
+
+std::atomic<int> Logger::s_minLevel{int(LogLevel::Info)};
+
+Logger &Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+{
+    setObjectName("logger");
+    allocate(8192);
+}
+
+void Logger::allocate(int capacity)
+{
+    // Размер — степень двойки, чтобы номер ячейки брался маской
+    quint64 size = 1;
+    while (size < quint64(capacity)) size <<= 1;
+
+    m_slots.reset(new Slot[size]);
+    for (quint64 i = 0; i < size; ++i)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    m_mask = size - 1;
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail = 0;
+}
+
+void Logger::configure(const ServerConfig &config)
+{
+    s_minLevel.store(config.logLevel, std::memory_order_relaxed);
+    allocate(config.logBufferSize);
+
+    m_filePath = config.logFile;
+    m_maxFileSize = config.logMaxFileSize;
+    m_maxFiles = config.logMaxFiles;
+    if (!m_filePath.isEmpty()) openFile();
+}
+
+void Logger::write(LogLevel level, const QString &event, const QString &user, const QString &message)
+{
+    if (!enabled(level)) return;
+
+    LogRecord record;
+    record.msecs = QDateTime::currentMSecsSinceEpoch();
+    record.level = level;
+    record.event = event;
+    record.user = user;
+    record.message = message;
+
+    // Поток еще не запущен (или уже остановлен) — пишем сами. Флаг ставит start() до появления
+    // других потоков и снимает run() после того, как все остальные остановлены
+    if (!m_running.load(std::memory_order_acquire)) {
+        QByteArray line;
+        format(record, line);
+        output(line);
+        return;
+    }
+
+    if (!push(std::move(record))) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (m_sleeping.load() && m_sleeping.exchange(false))
+        m_wake.release();
+}
+
+void Logger::start()
+{
+    m_running.store(true, std::memory_order_release);
+    QThread::start();
+}
+
+void Logger::stop()
+{
+    m_stopping.store(true);
+    m_wake.release();
+    wait();
+}
+
+bool Logger::push(LogRecord &&record)
+{
+    quint64 pos = m_head.load(std::memory_order_relaxed);
+    Slot *slot;
+    forever {
+        slot = &m_slots[pos & m_mask];
+        const quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        const qint64 diff = qint64(sequence) - qint64(pos);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // кольцо полно
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->record = std::move(record);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool Logger::pop(LogRecord &record)
+{
+    Slot &slot = m_slots[m_tail & m_mask];
+    if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1) return false;
+
+    record = std::move(slot.record);
+    slot.sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+    ++m_tail;
+    return true;
+}
+
+void Logger::run()
+{
+    QByteArray batch;
+    LogRecord record;
+    forever {
+        batch.clear();
+        for (int i = 0; i < kMaxBatch && pop(record); ++i)
+            format(record, batch);
+
+        // О потерях сообщаем одной строкой, а не на каждую запись
+        const quint64 dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != m_reportedDropped) {
+            LogRecord report;
+            report.msecs = QDateTime::currentMSecsSinceEpoch();
+            report.level = LogLevel::Warning;
+            report.event = "log_dropped";
+            report.message = QString("%1 log records dropped, buffer full").arg(dropped - m_reportedDropped);
+            format(report, batch);
+            m_reportedDropped = dropped;
+        }
+
+        if (!batch.isEmpty()) {
+            output(batch);
+            continue;
+        }
+        if (m_stopping.load()) break;
+
+        // Засыпаем; тот, кто запишет следующим, разбудит
+        m_sleeping.store(true);
+        if (m_slots[m_tail & m_mask].sequence.load(std::memory_order_acquire) == m_tail + 1) {
+            m_sleeping.store(false);
+            continue;
+        }
+        m_wake.tryAcquire(1, kIdleWaitMs);
+        m_sleeping.store(false);
+    }
+
+    m_running.store(false, std::memory_order_release);
+    // Что успели положить, пока мы выходили
+    batch.clear();
+    while (pop(record)) format(record, batch);
+    if (!batch.isEmpty()) output(batch);
+    if (m_file.isOpen()) m_file.flush();
+}
+
+void Logger::format(const LogRecord &record, QByteArray &out)
+{
+    const qint64 second = record.msecs / 1000;
+    if (second != m_cachedSecond) {
+        m_cachedSecond = second;
+        m_cachedTime = QDateTime::fromSecsSinceEpoch(second).toString("yyyy-MM-dd hh:mm:ss").toLatin1();
+    }
+
+    const int millis = int(record.msecs % 1000);
+    out.append(m_cachedTime);
+    out.append('.');
+    out.append(char('0' + millis / 100));
+    out.append(char('0' + millis / 10 % 10));
+    out.append(char('0' + millis % 10));
+    out.append(levelPrefix(record.level));
+    if (!record.event.isEmpty()) out.append("event=").append(record.event.toUtf8()).append(' ');
+    if (!record.user.isEmpty()) out.append("user=").append(record.user.toUtf8()).append(' ');
+    out.append(record.message.toUtf8());
+    out.append('\n');
+}
+
+void Logger::output(const QByteArray &data)
+{
+    if (m_filePath.isEmpty()) {
+        std::fwrite(data.constData(), 1, size_t(data.size()), stderr);
+        std::fflush(stderr);
+        return;
+    }
+
+    if (m_file.isOpen() && m_file.size() + data.size() > m_maxFileSize) rotate();
+    if (!m_file.isOpen()) {
+        std::fwrite(data.constData(), 1, size_t(data.size()), stderr);
+        return;
+    }
+    m_file.write(data);
+    m_file.flush();
+}
+
+void Logger::openFile()
+{
+    m_file.close();
+    m_file.setFileName(m_filePath);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        std::fprintf(stderr, "Cannot open log file %s, logging to stderr\n", qPrintable(m_filePath));
+}
+
+// server.log -> server.log.1 -> ... -> server.log.N (самый старый удаляется)
+void Logger::rotate()
+{
+    m_file.close();
+    QFile::remove(QString("%1.%2").arg(m_filePath).arg(m_maxFiles));
+    for (int i = m_maxFiles - 1; i >= 1; --i)
+        QFile::rename(QString("%1.%2").arg(m_filePath).arg(i), QString("%1.%2").arg(m_filePath).arg(i + 1));
+    QFile::rename(m_filePath, m_filePath + ".1");
+    openFile();
+}
@@ -0,0 +1,107 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <memory>
+
+struct ServerConfig;
+
+enum class LogLevel {
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3
+};
+
+// Все, что ниже этого уровня, отбрасывается еще при сборке: DEFINES += MESSENGER_LOG_MIN_LEVEL=1
+#ifndef MESSENGER_LOG_MIN_LEVEL
+#define MESSENGER_LOG_MIN_LEVEL 0
+#endif
+
+struct LogRecord {
+    qint64 msecs = 0; // время берем при записи, форматирует уже поток логгера
+    LogLevel level = LogLevel::Info;
+    QString event;    // короткое имя события: register, upload, slow_client...
+    QString user;
+    QString message;
+};
+
+// Асинхронный лог: потоки кладут записи в кольцо фиксированного размера без блокировок,
+// отдельный поток форматирует их пачками и пишет в stderr или в файл с ротацией.
+// Если кольцо заполнено, запись выбрасывается и попадает в счетчик потерянных.
+class Logger : public QThread {
+    Q_OBJECT
+public:
+    static Logger &instance();
+
+    static bool enabled(LogLevel level)
+    {
+        return int(level) >= MESSENGER_LOG_MIN_LEVEL && int(level) >= s_minLevel.load(std::memory_order_relaxed);
+    }
+
+    // Вызывать до start(): размер кольца, уровень, куда писать
+    void configure(const ServerConfig &config);
+
+    void write(LogLevel level, const QString &event, const QString &user, const QString &message);
+
+    // Вместо QThread::start(): с этого вызова все пишут только в кольцо, даже если поток еще не успел запуститься
+    void start();
+
+    // Дописывает все, что осталось в кольце, и завершает поток
+    void stop();
+
+    quint64 dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+protected:
+    void run() override;
+
+private:
+    // Тесту нужен свой логгер, а не общий, и кольцо без читающего потока
+    friend class TestLogger;
+
+    struct Slot {
+        std::atomic<quint64> sequence{0};
+        LogRecord record;
+    };
+
+    Logger();
+
+    void allocate(int capacity);
+    bool push(LogRecord &&record);
+    bool pop(LogRecord &record);
+    void format(const LogRecord &record, QByteArray &out);
+    void output(const QByteArray &data);
+    void openFile();
+    void rotate();
+
+    static std::atomic<int> s_minLevel;
+
+    // Кольцо (ограниченная очередь Вьюкова): пишут все потоки, читает только поток логгера
+    std::unique_ptr<Slot[]> m_slots;
+    quint64 m_mask = 0;
+    alignas(64) std::atomic<quint64> m_head{0};
+    alignas(64) quint64 m_tail = 0;
+
+    std::atomic<quint64> m_dropped{0};
+    quint64 m_reportedDropped = 0;
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_stopping{false};
+    QSemaphore m_wake;
+
+    QString m_filePath; // пусто — stderr
+    QFile m_file;
+    qint64 m_maxFileSize = 0;
+    int m_maxFiles = 0;
+
+    // Секунды форматируем один раз, миллисекунды дописываем сами
+    qint64 m_cachedSecond = -1;
+    QByteArray m_cachedTime;
+};
+
+#endif
@@ -0,0 +1,547 @@
+#include "logstore.h"
+#include "protocol.h"
+#include "server.h"
+#include "servercontext.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QtEndian>
+#include <algorithm>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr qint64 kHeaderSize = 8;
+constexpr quint64 kFlagFile = 1;
+const QString kCompactSuffix = ".compact";
+
+// FNV-1a: не CRC, но оборванную или недописанную запись ловит
+quint32 checksum(QByteArrayView data)
+{
+    quint32 hash = 2166136261u;
+    for (char c : data) {
+        hash ^= quint8(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool syncFile(QFile &file)
+{
+    if (!file.flush()) return false;
+#ifdef Q_OS_WIN
+    return ::_commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+}
+
+LogStore::LogStore(ServerContext *context)
+    : m_context(context)
+{
+}
+
+LogStore::~LogStore()
+{
+    close();
+}
+
+QString LogStore::segmentPath(quint32 number) const
+{
+    return m_dir + QString("/seg-%1.log").arg(number, 6, 10, QChar('0'));
+}
+
+LogStore::Segment *LogStore::openSegment(quint32 number, bool writable)
+{
+    auto *segment = new Segment;
+    segment->number = number;
+    segment->file.setFileName(segmentPath(number));
+    if (!segment->file.open(writable ? QIODevice::ReadWrite : QIODevice::ReadOnly)) {
+        Server::log("Cannot open message log segment " + segment->file.fileName() + ": " + segment->file.errorString(),
+                    Server::LogLevel::Error);
+        delete segment;
+        return nullptr;
+    }
+    segment->size = segment->file.size();
+    return segment;
+}
+
+// Закрытый сегмент отображается ровно по размеру
+bool LogStore::remap(Segment *segment)
+{
+    if (segment->data) {
+        segment->file.unmap(segment->data);
+        segment->data = nullptr;
+        segment->mapped = 0;
+    }
+    if (segment->size == 0) return true;
+
+    segment->data = segment->file.map(0, segment->size);
+    if (!segment->data) {
+        Server::log("Cannot map message log segment " + segment->file.fileName(), Server::LogLevel::Error);
+        return false;
+    }
+    segment->mapped = segment->size;
+    return true;
+}
+
+// Активный сегмент: файл сразу растягиваем (без записи, дыркой) до полного размера и отображаем
+// один раз — дальше пачки только двигают size. Лишний хвост отрезается, когда сегмент закрывается
+bool LogStore::reserve(Segment *segment, qint64 capacity)
+{
+    if (segment->data) {
+        segment->file.unmap(segment->data);
+        segment->data = nullptr;
+        segment->mapped = 0;
+    }
+    if (!segment->file.resize(capacity)) {
+        Server::log("Cannot grow message log segment " + segment->file.fileName() + ": " + segment->file.errorString(),
+                    Server::LogLevel::Error);
+        return false;
+    }
+    segment->data = segment->file.map(0, capacity);
+    if (!segment->data) {
+        Server::log("Cannot map message log segment " + segment->file.fileName(), Server::LogLevel::Error);
+        return false;
+    }
+    segment->mapped = capacity;
+    return true;
+}
+
+// Обрезать запас активного сегмента и отобразить то, что в нем есть
+bool LogStore::seal(Segment *segment)
+{
+    if (segment->data) {
+        segment->file.unmap(segment->data);
+        segment->data = nullptr;
+        segment->mapped = 0;
+    }
+    if (segment->file.size() != segment->size && !segment->file.resize(segment->size)) return false;
+    return remap(segment);
+}
+
+// Проход по сегменту при старте. false — дальше какого-то места записи битые, size указывает на него
+bool LogStore::scanSegment(Segment *segment)
+{
+    if (!remap(segment)) return false;
+
+    const char *base = reinterpret_cast<const char*>(segment->data);
+    qint64 pos = 0;
+    while (pos + kHeaderSize <= segment->mapped) {
+        const quint32 length = qFromLittleEndian<quint32>(base + pos);
+        const quint32 sum = qFromLittleEndian<quint32>(base + pos + 4);
+        if (length > segment->mapped - pos - kHeaderSize) break;
+
+        const QByteArrayView payload(base + pos + kHeaderSize, length);
+        MessageRecord record;
+        if (checksum(payload) != sum || !decode(payload, record)) break;
+
+        index(record, segment, quint32(pos));
+        pos += kHeaderSize + length;
+    }
+
+    const bool intact = pos == segment->mapped;
+    segment->size = pos;
+    return intact;
+}
+
+bool LogStore::open()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    m_dir = QDir(m_context->config.storeDir).absolutePath();
+    QDir dir(m_dir);
+    if (!dir.mkpath(".")) {
+        Server::log("Cannot create message log directory " + m_dir, Server::LogLevel::Error);
+        return false;
+    }
+
+    // Компактизация, прерванная падением: старый сегмент на месте — новый недописан, иначе доводим до конца
+    for (const QString &name : dir.entryList({"seg-*.log" + kCompactSuffix}, QDir::Files)) {
+        const QString original = name.chopped(kCompactSuffix.size());
+        if (dir.exists(original))
+            dir.remove(name);
+        else
+            dir.rename(name, original);
+    }
+
+    QWriteLocker locker(&m_lock);
+    const QStringList names = dir.entryList({"seg-*.log"}, QDir::Files, QDir::Name);
+    for (int i = 0; i < names.size(); ++i) {
+        bool ok = false;
+        const quint32 number = names.at(i).mid(4, names.at(i).size() - 8).toUInt(&ok);
+        if (!ok) continue;
+
+        const bool last = i == names.size() - 1;
+        Segment *segment = openSegment(number, last);
+        if (!segment) return false;
+        m_segments.insert(number, segment);
+
+        const qint64 fileSize = segment->file.size();
+        if (scanSegment(segment)) continue;
+
+        if (last) {
+            // Одни нули — просто запас активного сегмента после аварийной остановки.
+            // Иначе упали посреди записи пачки — ее никто не подтверждал, отрезаем
+            const QByteArrayView tail(reinterpret_cast<const char*>(segment->data) + segment->size,
+                                      segment->mapped - segment->size);
+            if (std::any_of(tail.begin(), tail.end(), [](char c) { return c != 0; }))
+                Server::log(QString("Message log: torn tail of %1 truncated at %2 (%3 bytes dropped)")
+                                .arg(names.at(i)).arg(segment->size).arg(fileSize - segment->size),
+                            Server::LogLevel::Warning);
+            seal(segment);
+        } else {
+            Server::log(QString("Message log: %1 is damaged after offset %2, the rest of it is skipped")
+                            .arg(names.at(i)).arg(segment->size),
+                        Server::LogLevel::Error);
+        }
+    }
+
+    if (m_segments.isEmpty()) {
+        Segment *segment = openSegment(1, true);
+        if (!segment) return false;
+        m_segments.insert(1, segment);
+    }
+    m_active = m_segments.last();
+    if (!reserve(m_active, qMax(m_active->size, m_context->config.storeSegmentSize))) return false;
+
+    qsizetype messages = 0;
+    for (const QList<Location> &locations : std::as_const(m_conversations))
+        messages += locations.size();
+    Server::log(QString("Message log: %1 segments, %2 messages in %3 conversations indexed in %4 ms")
+                    .arg(m_segments.size()).arg(messages).arg(m_conversations.size()).arg(timer.elapsed()));
+    return true;
+}
+
+bool LogStore::lastId(quint64 &id)
+{
+    QReadLocker locker(&m_lock);
+    id = m_lastId;
+    return true;
+}
+
+bool LogStore::blobRefCounts(QHash<QByteArray, int> &counts)
+{
+    QReadLocker locker(&m_lock);
+    if (!m_active) return false;
+
+    for (const Location &location : std::as_const(m_files)) {
+        MessageRecord record;
+        if (readRecord(location, record)) ++counts[record.blobHash];
+    }
+    return true;
+}
+
+bool LogStore::roll()
+{
+    {
+        // Старый сегмент закрываем первым: упадем дальше — он просто останется последним
+        QWriteLocker locker(&m_lock);
+        if (!seal(m_active)) return false;
+    }
+
+    Segment *segment = openSegment(m_active->number + 1, true);
+    if (!segment) return false;
+    if (!reserve(segment, m_context->config.storeSegmentSize)) {
+        delete segment;
+        return false;
+    }
+
+    QWriteLocker locker(&m_lock);
+    m_segments.insert(segment->number, segment);
+    m_active = segment;
+    return true;
+}
+
+// Вся пачка — один write и один fsync; сегмент меняем только между пачками
+bool LogStore::append(const QList<MessageRecord> &batch)
+{
+    if (!m_active) return false;
+
+    QByteArray out;
+    QList<quint32> offsets;
+    offsets.reserve(batch.size());
+    for (const MessageRecord &record : batch) {
+        offsets.append(quint32(out.size()));
+        out.append(encode(record));
+    }
+
+    if (m_active->size > 0 && m_active->size + out.size() > m_context->config.storeSegmentSize && !roll())
+        return false;
+    // Пачка больше целого сегмента — единственный случай, когда отображение приходится расширять
+    if (m_active->size + out.size() > m_active->mapped) {
+        QWriteLocker locker(&m_lock);
+        if (!reserve(m_active, m_active->size + out.size())) return false;
+    }
+
+    QFile &file = m_active->file;
+    if (!file.seek(m_active->size) || file.write(out) != out.size() || !syncFile(file)) {
+        Server::log("Message log write failed: " + file.errorString(), Server::LogLevel::Error);
+        // Полпачки затираем нулями — при старте это выглядело бы как битый хвост
+        if (file.seek(m_active->size)) file.write(QByteArray(out.size(), '\0'));
+        return false;
+    }
+
+    QWriteLocker locker(&m_lock);
+    const qint64 base = m_active->size;
+    m_active->size += out.size();
+    for (qsizetype i = 0; i < batch.size(); ++i)
+        index(batch.at(i), m_active, quint32(base + offsets.at(i)));
+    return true;
+}
+
+// Срок хранения: закрытые сегменты со слишком старыми сообщениями переписываются без них
+void LogStore::maintain()
+{
+    const int days = m_context->config.storeRetentionDays;
+    if (days == 0 || !m_active) return;
+
+    const qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - qint64(days) * 24 * 3600 * 1000;
+    // Набор сегментов меняет только этот поток — читаем без блокировки
+    const QList<Segment*> segments = m_segments.values();
+    for (Segment *segment : segments) {
+        if (segment != m_active && segment->oldest != 0 && segment->oldest < cutoff)
+            compact(segment, cutoff);
+    }
+}
+
+void LogStore::compact(Segment *segment, qint64 cutoff)
+{
+    // Старое отображение читаем без блокировки: меняет его только этот поток
+    const char *base = reinterpret_cast<const char*>(segment->data);
+    QByteArray out;
+    QList<MessageRecord> kept;
+    QList<quint32> keptOffsets;
+    QList<MessageRecord> dropped;
+    qint64 oldest = 0;
+    qint64 newest = 0;
+
+    for (qint64 pos = 0; pos < segment->size; ) {
+        const qint64 recordSize = kHeaderSize + qFromLittleEndian<quint32>(base + pos);
+        MessageRecord record;
+        decode(QByteArrayView(base + pos + kHeaderSize, recordSize - kHeaderSize), record);
+
+        const qint64 msecs = record.timestamp.toMSecsSinceEpoch();
+        if (msecs < cutoff) {
+            dropped.append(record);
+        } else {
+            keptOffsets.append(quint32(out.size()));
+            out.append(base + pos, recordSize);
+            kept.append(record);
+            oldest = oldest == 0 ? msecs : qMin(oldest, msecs);
+            newest = qMax(newest, msecs);
+        }
+        pos += recordSize;
+    }
+    if (dropped.isEmpty()) return;
+
+    // Новая версия пишется рядом и подменяет старую только целиком записанной
+    const quint32 number = segment->number;
+    const QString path = segmentPath(segment->number);
+    const QString compactPath = path + kCompactSuffix;
+    if (!kept.isEmpty()) {
+        QFile compacted(compactPath);
+        if (!compacted.open(QIODevice::WriteOnly | QIODevice::Truncate) || compacted.write(out) != out.size()
+            || !syncFile(compacted)) {
+            Server::log("Message log compaction failed: " + compacted.errorString(), Server::LogLevel::Error);
+            compacted.close();
+            QFile::remove(compactPath);
+            return;
+        }
+    }
+
+    {
+        QWriteLocker locker(&m_lock);
+        for (const MessageRecord &record : std::as_const(dropped))
+            unindex(record);
+
+        segment->file.unmap(segment->data);
+        segment->data = nullptr;
+        segment->mapped = 0;
+        segment->file.close();
+        QFile::remove(path);
+
+        if (kept.isEmpty()) {
+            m_segments.remove(number);
+            delete segment;
+        } else {
+            QFile::rename(compactPath, path);
+            segment->file.open(QIODevice::ReadOnly);
+            segment->size = out.size();
+            segment->oldest = oldest;
+            segment->newest = newest;
+            remap(segment);
+
+            const auto byId = [](const Location &location, quint64 id) { return location.id < id; };
+            for (qsizetype i = 0; i < kept.size(); ++i) {
+                const MessageRecord &record = kept.at(i);
+                QList<Location> &locations = m_conversations[HistoryCache::conversationKey(record.sender, record.receiver)];
+                const auto it = std::lower_bound(locations.begin(), locations.end(), record.id, byId);
+                if (it != locations.end() && it->id == record.id) it->offset = keptOffsets.at(i);
+                if (record.isFile) m_files[record.id].offset = keptOffsets.at(i);
+            }
+        }
+    }
+
+    // Кэш истории мог запомнить выброшенные сообщения: забываем эти разговоры до того, как удалить
+    // вложения, иначе следующая история сослалась бы на файлы, которых уже нет
+    QSet<QString> affected;
+    for (const MessageRecord &record : std::as_const(dropped))
+        affected.insert(HistoryCache::conversationKey(record.sender, record.receiver));
+    for (const QString &key : std::as_const(affected))
+        m_context->history.invalidate(key);
+    for (const MessageRecord &record : std::as_const(dropped)) {
+        if (record.isFile) m_context->blobs.release(record.blobHash);
+    }
+    Server::log(QString("Message log: segment %1 compacted, %2 expired messages dropped, %3 kept")
+                    .arg(number).arg(dropped.size()).arg(kept.size()));
+}
+
+void LogStore::close()
+{
+    QWriteLocker locker(&m_lock);
+    for (Segment *segment : std::as_const(m_segments)) {
+        if (segment->data) segment->file.unmap(segment->data);
+        // Запас активного сегмента на диске не оставляем
+        if (segment == m_active && segment->file.size() != segment->size) segment->file.resize(segment->size);
+        segment->file.close();
+        delete segment;
+    }
+    m_segments.clear();
+    m_active = nullptr;
+}
+
+// Под m_lock на запись (или при старте, до потоков)
+void LogStore::index(const MessageRecord &record, Segment *segment, quint32 offset)
+{
+    const Location location{record.id, segment->number, offset};
+
+    // id раздаются при постановке в очередь, шарды кладут их почти по порядку — ищем место с конца
+    QList<Location> &locations = m_conversations[HistoryCache::conversationKey(record.sender, record.receiver)];
+    auto position = locations.end();
+    while (position != locations.begin() && (position - 1)->id > record.id)
+        --position;
+    locations.insert(position, location);
+
+    if (record.isFile) m_files.insert(record.id, location);
+    m_lastId = qMax(m_lastId, record.id);
+
+    const qint64 msecs = record.timestamp.toMSecsSinceEpoch();
+    segment->oldest = segment->oldest == 0 ? msecs : qMin(segment->oldest, msecs);
+    segment->newest = qMax(segment->newest, msecs);
+}
+
+void LogStore::unindex(const MessageRecord &record)
+{
+    const QString key = HistoryCache::conversationKey(record.sender, record.receiver);
+    auto conversation = m_conversations.find(key);
+    if (conversation != m_conversations.end()) {
+        QList<Location> &locations = conversation.value();
+        const auto it = std::lower_bound(locations.begin(), locations.end(), record.id,
+                                         [](const Location &location, quint64 id) { return location.id < id; });
+        if (it != locations.end() && it->id == record.id) locations.erase(it);
+        if (locations.isEmpty()) m_conversations.erase(conversation);
+    }
+    m_files.remove(record.id);
+}
+
+// Под m_lock (на чтение достаточно)
+bool LogStore::readRecord(const Location &location, MessageRecord &record) const
+{
+    const Segment *segment = m_segments.value(location.segment);
+    // Отображение могло не восстановиться после неудачного roll()/reserve()
+    if (!segment || !segment->data || location.offset + kHeaderSize > segment->size) return false;
+
+    const char *base = reinterpret_cast<const char*>(segment->data) + location.offset;
+    const quint32 length = qFromLittleEndian<quint32>(base);
+    if (length > segment->size - location.offset - kHeaderSize) return false;
+    return decode(QByteArrayView(base + kHeaderSize, length), record);
+}
+
+bool LogStore::loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                        QList<HistoryEntry> &entries)
+{
+    QReadLocker locker(&m_lock);
+    entries.clear();
+    const auto it = m_conversations.constFind(HistoryCache::conversationKey(myNick, friendNick));
+    if (it == m_conversations.constEnd()) return true;
+
+    const QList<Location> &all = it.value();
+    const auto end = beforeId == 0 ? all.end()
+                                   : std::lower_bound(all.begin(), all.end(), beforeId,
+                                                      [](const Location &location, quint64 id) { return location.id < id; });
+    const auto begin = end - qMin<qsizetype>(limit, end - all.begin());
+
+    entries.reserve(end - begin);
+    for (auto location = begin; location != end; ++location) {
+        MessageRecord record;
+        if (readRecord(*location, record)) entries.append(historyEntry(record));
+    }
+    return true;
+}
+
+bool LogStore::findFile(quint64 messageId, StoredFile &file)
+{
+    QReadLocker locker(&m_lock);
+    const auto it = m_files.constFind(messageId);
+    MessageRecord record;
+    if (it == m_files.constEnd() || !readRecord(it.value(), record)) return false;
+
+    file.sender = record.sender;
+    file.receiver = record.receiver;
+    file.name = record.message;
+    file.blobHash = record.blobHash;
+    file.size = record.fileSize;
+    return true;
+}
+
+// [id][флаги][время, мс][отправитель][получатель][текст или имя файла] + у файла [hash][размер]
+QByteArray LogStore::encode(const MessageRecord &record)
+{
+    QByteArray payload;
+    Protocol::appendVarint(payload, record.id);
+    Protocol::appendVarint(payload, record.isFile ? kFlagFile : 0);
+    Protocol::appendVarint(payload, quint64(record.timestamp.toMSecsSinceEpoch()));
+    Protocol::appendField(payload, record.sender.toUtf8());
+    Protocol::appendField(payload, record.receiver.toUtf8());
+    Protocol::appendField(payload, record.message.toUtf8());
+    if (record.isFile) {
+        Protocol::appendField(payload, record.blobHash);
+        Protocol::appendVarint(payload, quint64(record.fileSize));
+    }
+
+    QByteArray out(kHeaderSize, Qt::Uninitialized);
+    qToLittleEndian<quint32>(quint32(payload.size()), out.data());
+    qToLittleEndian<quint32>(checksum(payload), out.data() + 4);
+    return out + payload;
+}
+
+bool LogStore::decode(QByteArrayView payload, MessageRecord &record)
+{
+    Protocol::PayloadReader reader(payload);
+    quint64 flags = 0, msecs = 0;
+    QByteArrayView sender, receiver, message;
+    if (!reader.readVarint(record.id) || !reader.readVarint(flags) || !reader.readVarint(msecs)
+        || !reader.readField(sender) || !reader.readField(receiver) || !reader.readField(message))
+        return false;
+
+    record.sender = QString::fromUtf8(sender);
+    record.receiver = QString::fromUtf8(receiver);
+    record.message = QString::fromUtf8(message);
+    record.timestamp = QDateTime::fromMSecsSinceEpoch(qint64(msecs));
+    record.isFile = flags & kFlagFile;
+    if (record.isFile) {
+        QByteArrayView hash;
+        quint64 size = 0;
+        if (!reader.readField(hash) || !reader.readVarint(size)) return false;
+        record.blobHash = hash.toByteArray();
+        record.fileSize = qint64(size);
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include <QFile>
+#include <QMap>
+#include <QReadWriteLock>
+#include "messagestore.h"
+
+// Встроенное хранилище без сервера БД: журнал на локальном диске из сегментов seg-NNNNNN.log,
+// только дозапись в конец. Запись: [u32 длина][u32 контрольная сумма][поля сообщения].
+// Пачка MessageWriter — одна запись в файл и один fsync. Активный сегмент заранее растянут
+// до полного размера и отображен один раз.
+// Индекс (переписка -> смещения записей) только в памяти, при старте строится заново
+// проходом по отображенным в память сегментам; оборванный хвост последнего сегмента отрезается.
+// Сообщения старше --retention-days выкидываются компактизацией закрытых сегментов.
+class LogStore : public MessageStore {
+public:
+    explicit LogStore(ServerContext *context);
+    ~LogStore() override;
+
+    bool open() override;
+    bool lastId(quint64 &id) override;
+    bool blobRefCounts(QHash<QByteArray, int> &counts) override;
+    bool append(const QList<MessageRecord> &batch) override;
+    void maintain() override;
+    void close() override;
+
+    bool loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                  QList<HistoryEntry> &entries) override;
+    bool findFile(quint64 messageId, StoredFile &file) override;
+
+    QString name() const override { return "log"; }
+
+private:
+    struct Location {
+        quint64 id = 0;
+        quint32 segment = 0;
+        quint32 offset = 0;
+    };
+
+    struct Segment {
+        quint32 number = 0;
+        QFile file;
+        uchar *data = nullptr; // отображение [0, mapped); у активного сегмента — сразу на весь размер
+        qint64 mapped = 0;
+        qint64 size = 0;       // до куда записи целые, дальше у активного сегмента нули
+        qint64 oldest = 0;     // время самого старого и самого нового сообщения, мс
+        qint64 newest = 0;
+    };
+
+    QString segmentPath(quint32 number) const;
+    Segment *openSegment(quint32 number, bool writable);
+    bool scanSegment(Segment *segment);
+    bool remap(Segment *segment);
+    bool reserve(Segment *segment, qint64 capacity);
+    bool seal(Segment *segment);
+    bool roll();
+    void compact(Segment *segment, qint64 cutoff);
+
+    void index(const MessageRecord &record, Segment *segment, quint32 offset);
+    void unindex(const MessageRecord &record);
+    bool readRecord(const Location &location, MessageRecord &record) const;
+
+    static QByteArray encode(const MessageRecord &record);
+    static bool decode(QByteArrayView payload, MessageRecord &record);
+
+    ServerContext *m_context;
+    QString m_dir;
+
+    // Под m_lock: индекс и отображения. Файлы меняет только поток записи
+    mutable QReadWriteLock m_lock;
+    QMap<quint32, Segment*> m_segments;
+    Segment *m_active = nullptr;
+    QHash<QString, QList<Location>> m_conversations; // по возрастанию id
+    QHash<quint64, Location> m_files;
+    QHash<QByteArray, int> m_blobRefs;
+    quint64 m_lastId = 0;
+};
+
+#endif
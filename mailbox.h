@@ -0,0 +1,58 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <utility>
+
+// Неблокирующая очередь "много писателей — один читатель" (схема Вьюкова).
+// push() можно звать из любого потока, pop() — только из потока-владельца.
+template <typename T>
+class Mailbox {
+public:
+    Mailbox()
+        : m_head(new Node)
+        , m_tail(m_head.load(std::memory_order_relaxed))
+    {
+    }
+
+    ~Mailbox()
+    {
+        T value;
+        while (pop(value)) {}
+        delete m_tail;
+    }
+
+    Q_DISABLE_COPY(Mailbox)
+
+    void push(T value)
+    {
+        Node *node = new Node;
+        node->value = std::move(value);
+        Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T &value)
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+
+        value = std::move(next->value);
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    std::atomic<Node*> m_head;
+    Node *m_tail;
+};
+
+#endif
@@ -1,8 +1,163 @@
 #include <QCoreApplication>
+#include <QDir>
+#include <QThread>
+#include "listener.h"
+#include "logger.h"
+#include "messagestore.h"
+#include "messagewriter.h"
 #include "server.h"
+#include "servercontext.h"
+#include "statsserver.h"
+
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <csignal>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// SIGINT/SIGTERM -> обычный quit(), чтобы успеть дописать очередь в БД.
+// Из обработчика сигнала можно только write(), поэтому через socketpair.
+// Флаг — для запуска, пока event loop еще не крутится и socketpair никто не читает
+static int signalFds[2];
+static volatile std::sig_atomic_t signalled = 0;
+
+static void onSignal(int)
+{
+    signalled = 1;
+    char byte = 1;
+    ::write(signalFds[0], &byte, sizeof(byte));
+}
+
+static bool shutdownRequested()
+{
+    return signalled != 0;
+}
+
+static void installSignalHandlers(QCoreApplication *app)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFds) != 0) return;
+
+    auto *notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, app);
+    QObject::connect(notifier, &QSocketNotifier::activated, app, [app, notifier]() {
+        notifier->setEnabled(false);
+        char byte;
+        ::read(signalFds[1], &byte, sizeof(byte));
+        Server::log("Shutdown requested");
+        app->quit();
+    });
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+}
+#else
+static bool shutdownRequested()
+{
+    return false;
+}
+#endif
+
+// Хранилище так и не открылось — отличаем от ошибки в аргументах (1)
+static constexpr int kExitStorageUnavailable = 2;
+// Как часто при запуске проверяем, не просят ли остановиться
+static constexpr int kStartupPollMs = 100;
 
 int main(int argc, char *argv[]) {
     QCoreApplication a(argc, argv);
-    Server server;
-    return a.exec();
+#ifdef Q_OS_UNIX
+    installSignalHandlers(&a);
+#endif
+
+    ServerContext context;
+    context.config = ServerConfig::fromArguments(a.arguments());
+
+    // Лог пишет свой поток; до старта и после остановки записи идут напрямую
+    Logger::instance().configure(context.config);
+    Logger::instance().start();
+    context.startTime = QDateTime::currentDateTime();
+    context.history.setLimits(context.config.historyCacheConversations, kHistoryPageSize);
+
+    // Недокачанные файлы держим сутки — вдруг клиент вернется и продолжит
+    context.spoolDir = QDir::tempPath() + "/messenger-spool";
+    FileUpload::cleanupSpool(context.spoolDir, 24 * 3600);
+    context.blobs.setRoot(QDir(context.config.blobDir).absolutePath());
+
+    // Хранилище открывает поток записи; ждем, пока он узнает последний id. Если хранилище лежит,
+    // поток пробует снова — ожидание прерывается сигналом и ограничено --store-open-attempts
+    const std::unique_ptr<MessageStore> store = MessageStore::create(&context);
+    context.store = store.get();
+    Server::log("Message storage: " + store->name());
+    MessageWriter writer(&context);
+    writer.start();
+    bool stopRequested = false;
+    while (!writer.waitUntilReady(kStartupPollMs)) {
+        if (!stopRequested && shutdownRequested()) {
+            Server::log("Shutdown requested while opening message storage");
+            writer.stop();
+            stopRequested = true;
+        }
+    }
+    if (stopRequested || !writer.isOpen()) {
+        writer.stop();
+        writer.wait();
+        Logger::instance().stop();
+        return stopRequested ? 0 : kExitStorageUnavailable;
+    }
+    context.writer = &writer;
+
+    // Каждый шард — свой поток со своим event loop
+    QList<QThread*> threads;
+    for (int i = 0; i < context.config.workerThreads; ++i) {
+        auto *thread = new QThread;
+        thread->setObjectName(QString("shard-%1").arg(i));
+
+        auto *shard = new Server(i, &context);
+        shard->moveToThread(thread);
+        QObject::connect(thread, &QThread::started, shard, &Server::start);
+        // Сам шард удаляем только после остановки всех потоков: соседи шлют ему до последнего
+        QObject::connect(thread, &QThread::finished, shard, &Server::shutdown);
+
+        context.shards.append(shard);
+        threads.append(thread);
+    }
+    for (QThread *thread : threads)
+        thread->start();
+
+    Listener listener(&context);
+    if (listener.listen(QHostAddress::Any, context.config.port))
+        Server::log(QString("Server started on port %1 with %2 worker threads")
+                        .arg(context.config.port).arg(threads.size()));
+    else
+        Server::log("Server failed to start!", Server::LogLevel::Error);
+
+    // Метрики — только локально, наружу их отдает тот, кто их собирает
+    StatsServer stats(&context);
+    if (context.config.statsPort != 0) {
+        if (stats.listen(QHostAddress::LocalHost, context.config.statsPort))
+            Server::log(QString("Metrics on http://127.0.0.1:%1/metrics").arg(context.config.statsPort));
+        else
+            Server::log("Metrics port unavailable: " + stats.errorString(), Server::LogLevel::Warning);
+    }
+
+    QObject::connect(&a, &QCoreApplication::aboutToQuit, [&threads, &context, &writer]() {
+        // Сначала останавливаем все шарды, и только потом удаляем: пока жив хоть один,
+        // он может доставлять в почтовые ящики остальных
+        for (QThread *thread : std::as_const(threads))
+            thread->quit();
+        for (QThread *thread : std::as_const(threads))
+            thread->wait();
+
+        // Шарды остановлены, новых сообщений не будет — дописываем очередь. Подтверждения из
+        // последних пачек уходят в почтовые ящики шардов, так что удаляем их только после этого
+        writer.stop();
+        writer.wait();
+
+        qDeleteAll(context.shards);
+        context.shards.clear();
+        qDeleteAll(threads);
+        threads.clear();
+    });
+
+    const int code = a.exec();
+    Logger::instance().stop();
+    return code;
 }
@@ -0,0 +1,60 @@
+#include "memorystore.h"
+#include <algorithm>
+
+namespace {
+bool lessById(const HistoryEntry &entry, quint64 id)
+{
+    return entry.id < id;
+}
+}
+
+bool MemoryStore::lastId(quint64 &id)
+{
+    QReadLocker locker(&m_lock);
+    id = m_lastId;
+    return true;
+}
+
+bool MemoryStore::append(const QList<MessageRecord> &batch)
+{
+    QWriteLocker locker(&m_lock);
+    for (const MessageRecord &record : batch) {
+        const HistoryEntry entry = historyEntry(record);
+
+        // id раздаются при постановке в очередь, шарды кладут их почти по порядку — ищем место с конца
+        QList<HistoryEntry> &entries = m_conversations[HistoryCache::conversationKey(record.sender, record.receiver)];
+        auto position = entries.end();
+        while (position != entries.begin() && (position - 1)->id > entry.id)
+            --position;
+        entries.insert(position, entry);
+
+        if (record.isFile)
+            m_files.insert(record.id, StoredFile{record.sender, record.receiver, record.message, record.blobHash, record.fileSize});
+        m_lastId = qMax(m_lastId, record.id);
+    }
+    return true;
+}
+
+bool MemoryStore::loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                           QList<HistoryEntry> &entries)
+{
+    QReadLocker locker(&m_lock);
+    entries.clear();
+    const auto it = m_conversations.constFind(HistoryCache::conversationKey(myNick, friendNick));
+    if (it == m_conversations.constEnd()) return true;
+
+    const QList<HistoryEntry> &all = it.value();
+    const auto end = beforeId == 0 ? all.end() : std::lower_bound(all.begin(), all.end(), beforeId, lessById);
+    const auto begin = end - qMin<qsizetype>(limit, end - all.begin());
+    entries = QList<HistoryEntry>(begin, end);
+    return true;
+}
+
+bool MemoryStore::findFile(quint64 messageId, StoredFile &file)
+{
+    QReadLocker locker(&m_lock);
+    const auto it = m_files.constFind(messageId);
+    if (it == m_files.constEnd()) return false;
+    file = it.value();
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef MEMORYSTORE_H
+#define MEMORYSTORE_H
+
+#include <QReadWriteLock>
+#include "messagestore.h"
+
+// Все только в памяти, после перезапуска пусто. Для тестов и нагрузочных прогонов без БД
+class MemoryStore : public MessageStore {
+public:
+    bool open() override { return true; }
+    bool lastId(quint64 &id) override;
+    // Вложения прошлых запусков не наши — не трогаем их
+    bool blobRefCounts(QHash<QByteArray, int> &counts) override { Q_UNUSED(counts); return false; }
+    bool append(const QList<MessageRecord> &batch) override;
+
+    bool loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                  QList<HistoryEntry> &entries) override;
+    bool findFile(quint64 messageId, StoredFile &file) override;
+
+    QString name() const override { return "memory"; }
+
+private:
+    QReadWriteLock m_lock;
+    QHash<QString, QList<HistoryEntry>> m_conversations; // по возрастанию id
+    QHash<quint64, StoredFile> m_files;
+    quint64 m_lastId = 0;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "messagestore.h"
+#include "logstore.h"
+#include "memorystore.h"
+#include "pgstore.h"
+#include "servercontext.h"
+
+HistoryEntry historyEntry(const MessageRecord &record)
+{
+    HistoryEntry entry;
+    entry.id = record.id;
+    entry.sender = record.sender;
+    entry.message = record.message;
+    entry.timestamp = record.timestamp;
+    entry.isFile = record.isFile;
+    entry.blobHash = record.blobHash;
+    entry.fileSize = record.fileSize;
+    return entry;
+}
+
+std::unique_ptr<MessageStore> MessageStore::create(ServerContext *context)
+{
+    switch (context->config.storage) {
+    case StorageEngine::Memory:
+        return std::make_unique<MemoryStore>();
+    case StorageEngine::Log:
+        return std::make_unique<LogStore>(context);
+    case StorageEngine::Postgres:
+        break;
+    }
+    return std::make_unique<PgStore>(context->config);
+}
@@ -0,0 +1,72 @@
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <memory>
+#include "historycache.h"
+
+struct ServerContext;
+
+struct MessageRecord {
+    quint64 id = 0;
+    QString sender;
+    QString receiver;
+    QString message;     // текст или имя файла
+    bool isFile = false;
+    QByteArray blobHash; // файл лежит в BlobStore, в хранилище только ссылка
+    qint64 fileSize = 0;
+    QDateTime timestamp;
+    bool ack = false;    // прислать отправителю подтверждение после записи
+    qint64 enqueuedAt = 0; // monotonicNanos(), для метрики задержки записи
+};
+
+// То же сообщение так, как его видит история
+HistoryEntry historyEntry(const MessageRecord &record);
+
+// Вложение по id сообщения — для BlobGet
+struct StoredFile {
+    QString sender;
+    QString receiver;
+    QString name;
+    QByteArray blobHash;
+    qint64 size = 0;
+};
+
+// Где лежат сообщения. Пишет только MessageWriter (один поток), читают шарды — параллельно с записью.
+class MessageStore {
+public:
+    virtual ~MessageStore() = default;
+
+    // --- поток записи ---
+
+    // При старте: подключиться / поднять данные с диска, подготовить схему
+    virtual bool open() = 0;
+    // Последний записанный id (0 — пусто). false — узнать не удалось, писать с угаданного id нельзя
+    virtual bool lastId(quint64 &id) = 0;
+    // Сколько сообщений ссылается на каждое вложение. false — неизвестно, ничего не удалять
+    virtual bool blobRefCounts(QHash<QByteArray, int> &counts) = 0;
+    // Пачка пишется целиком или не пишется вовсе
+    virtual bool append(const QList<MessageRecord> &batch) = 0;
+    // Периодически, когда нечего писать
+    virtual void maintain() {}
+    virtual void close() {}
+
+    // --- любой шард ---
+
+    // Страница (от старых к новым) с id < beforeId; beforeId = 0 — самые свежие
+    virtual bool loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                          QList<HistoryEntry> &entries) = 0;
+    virtual bool findFile(quint64 messageId, StoredFile &file) = 0;
+    // Файлы из старых версий, лежащие прямо в БД
+    virtual QByteArray legacyFileBody(quint64 messageId) { Q_UNUSED(messageId); return QByteArray(); }
+
+    virtual QString name() const = 0;
+
+    static std::unique_ptr<MessageStore> create(ServerContext *context);
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "messagewriter.h"
+#include "server.h"
+#include "servercontext.h"
+#include <QElapsedTimer>
+
+namespace {
+// Как часто хранилищу дают прибраться (компактизация и т.п.), если писать нечего
+constexpr int kMaintenanceIntervalMs = 60 * 1000;
+// Повторы при недоступном хранилище: пауза удваивается от первой до последней
+constexpr int kRetryFirstDelayMs = 100;
+constexpr int kRetryMaxDelayMs = 30 * 1000;
+// Сколько раз пробуем записать пачку, прежде чем считать ее потерянной (около двух минут пауз)
+constexpr int kMaxBatchAttempts = 12;
+}
+
+MessageWriter::MessageWriter(ServerContext *context, QObject *parent)
+    : QThread(parent)
+    , m_context(context)
+{
+    setObjectName("db-writer");
+}
+
+bool MessageWriter::waitUntilReady(int timeoutMs)
+{
+    return m_ready.tryAcquire(1, timeoutMs);
+}
+
+quint64 MessageWriter::enqueue(MessageRecord record)
+{
+    // Очередь ограничена: лучше сразу сказать клиенту "занято", чем съесть всю память
+    if (m_pending.fetch_add(1, std::memory_order_relaxed) >= m_context->config.dbQueueCapacity) {
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    record.id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+    record.enqueuedAt = monotonicNanos();
+    const quint64 id = record.id;
+    // В кэш истории — раньше, чем запись увидит поток записи: иначе flushed() мог бы прийти до append()
+    m_context->history.append(HistoryCache::conversationKey(record.sender, record.receiver), historyEntry(record));
+    m_queue.push(std::move(record));
+    m_available.release();
+    return id;
+}
+
+void MessageWriter::stop()
+{
+    m_stopping.store(true);
+    m_available.release(); // разбудить, даже если очередь пуста
+}
+
+// Счетчики ссылок на вложения — до того, как шарды начнут принимать файлы
+void MessageWriter::prepareBlobStore()
+{
+    QHash<QByteArray, int> counts;
+    if (!m_context->store->blobRefCounts(counts)) return; // не знаем, что нужно, — ничего не удаляем
+
+    m_context->blobs.loadRefCounts(counts);
+    const int removed = m_context->blobs.removeUnreferenced();
+    Server::log(QString("Blob store: %1 files referenced, %2 orphans removed").arg(counts.size()).arg(removed));
+}
+
+// Пока хранилище не открыто и последний id неизвестен, сервер не принимает сообщений:
+// id раздаем сами, и начав с угаданного, каждая пачка столкнулась бы с уже записанными.
+// Сдаемся после config.storeOpenAttempts попыток (0 — пробуем, пока не остановят)
+bool MessageWriter::openStore()
+{
+    MessageStore *store = m_context->store;
+    const int maxAttempts = m_context->config.storeOpenAttempts;
+    int delayMs = kRetryFirstDelayMs;
+    for (int attempt = 1;; ++attempt) {
+        quint64 last = 0;
+        if (store->open() && store->lastId(last)) {
+            const quint64 next = last + 1;
+            quint64 current = m_nextId.load();
+            while (current < next && !m_nextId.compare_exchange_weak(current, next)) {}
+            return true;
+        }
+        if (maxAttempts > 0 && attempt >= maxAttempts) {
+            Server::log(QString("Message storage unavailable after %1 attempts, giving up").arg(attempt),
+                        Server::LogLevel::Error);
+            return false;
+        }
+
+        Server::log(QString("Message storage unavailable (attempt %1), retrying in %2 ms").arg(attempt).arg(delayMs),
+                    Server::LogLevel::Error);
+        // Писать еще некому, так что семафор будит только stop() — пауза не держит остановку
+        m_available.tryAcquire(1, delayMs);
+        if (m_stopping.load()) return false;
+        delayMs = qMin(delayMs * 2, kRetryMaxDelayMs);
+    }
+}
+
+void MessageWriter::run()
+{
+    MessageStore *store = m_context->store;
+    const bool opened = openStore();
+    if (opened) prepareBlobStore();
+    m_opened.store(opened);
+    m_ready.release();
+    if (!opened) return;
+
+    const int batchSize = m_context->config.dbBatchSize;
+    const int flushIntervalMs = m_context->config.dbFlushIntervalMs;
+
+    QList<MessageRecord> batch;
+    batch.reserve(batchSize);
+    QElapsedTimer batchAge;
+    QElapsedTimer sinceMaintenance;
+    sinceMaintenance.start();
+
+    forever {
+        // Пустая пачка — спим до первого сообщения или до уборки, иначе не дольше, чем осталось до сброса
+        const int waitMs = batch.isEmpty() ? kMaintenanceIntervalMs : int(qMax<qint64>(0, flushIntervalMs - batchAge.elapsed()));
+        if (m_available.tryAcquire(1, waitMs)) {
+            MessageRecord record;
+            if (m_queue.pop(record)) {
+                if (batch.isEmpty()) batchAge.start();
+                batch.append(std::move(record));
+            }
+        }
+
+        if (m_stopping.load()) {
+            MessageRecord record;
+            while (m_queue.pop(record))
+                batch.append(std::move(record));
+            if (!batch.isEmpty())
+                flush(batch);
+            break;
+        }
+
+        if (batch.size() >= batchSize || (!batch.isEmpty() && batchAge.hasExpired(flushIntervalMs)))
+            flush(batch);
+
+        if (batch.isEmpty() && sinceMaintenance.hasExpired(kMaintenanceIntervalMs)) {
+            store->maintain();
+            sinceMaintenance.restart();
+        }
+    }
+
+    store->close();
+    Server::log("Message writer stopped, queue drained");
+}
+
+void MessageWriter::flush(QList<MessageRecord> &batch)
+{
+    const int count = int(batch.size());
+    bool saved = false;
+    // Сообщения уже доставлены и лежат в кэше истории — не бросаем пачку после первой ошибки
+    int delayMs = kRetryFirstDelayMs;
+    for (int attempt = 1; attempt <= kMaxBatchAttempts; ++attempt) {
+        {
+            ScopedTimer timer(m_context->metrics.persistLatency);
+            saved = m_context->store->append(batch);
+        }
+        if (saved || attempt == kMaxBatchAttempts) break;
+
+        Server::log(QString("Message batch of %1 records failed (attempt %2), retrying in %3 ms")
+                        .arg(count).arg(attempt).arg(delayMs), Server::LogLevel::Warning);
+        msleep(delayMs);
+        delayMs = qMin(delayMs * 2, kRetryMaxDelayMs);
+    }
+
+    m_pending.fetch_sub(count, std::memory_order_relaxed);
+    // Записанное кэш истории больше не держит отдельно — его отдаст хранилище
+    for (const MessageRecord &record : std::as_const(batch))
+        m_context->history.flushed(HistoryCache::conversationKey(record.sender, record.receiver), record.id);
+
+    Metrics &metrics = m_context->metrics;
+    if (saved) {
+        metrics.messagesPersisted.add(count);
+        const qint64 now = monotonicNanos();
+        for (const MessageRecord &record : std::as_const(batch))
+            metrics.persistDelay.record(now - record.enqueuedAt);
+        sendAcks(batch);
+    } else {
+        metrics.messagesLost.add(count);
+        Server::log(QString("Message batch LOST: %1 records").arg(count), Server::LogLevel::Error);
+        // Ссылки из потерянных сообщений больше никто не держит
+        for (const MessageRecord &record : std::as_const(batch)) {
+            if (record.isFile) m_context->blobs.release(record.blobHash);
+        }
+    }
+    batch.clear();
+}
+
+void MessageWriter::sendAcks(const QList<MessageRecord> &batch)
+{
+    for (const MessageRecord &record : batch) {
+        if (!record.ack) continue;
+
+        UserDirectory::Entry entry;
+        if (!m_context->directory.lookup(record.sender, entry)) continue;
+
+        Envelope envelope;
+        envelope.target = record.sender;
+        envelope.type = Protocol::FrameType::Ack;
+        Protocol::appendVarint(envelope.payload, record.id);
+        entry.shard->post(std::move(envelope));
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef MESSAGEWRITER_H
+#define MESSAGEWRITER_H
+
+#include <QList>
+#include <QSemaphore>
+#include <QThread>
+#include <atomic>
+#include "mailbox.h"
+#include "messagestore.h"
+
+struct ServerContext;
+
+// Отложенная запись сообщений: свой поток, запись пачками по размеру или по времени —
+// сеть больше не ждет хранилище. Куда именно пишем — решает MessageStore.
+class MessageWriter : public QThread {
+    Q_OBJECT
+public:
+    MessageWriter(ServerContext *context, QObject *parent = nullptr);
+
+    // Ждет не дольше timeoutMs, пока поток не откроет хранилище и не узнает, с какого id продолжать,
+    // или не сдастся. false — еще пытается. Удалось ли — isOpen()
+    bool waitUntilReady(int timeoutMs);
+    bool isOpen() const { return m_opened.load(); }
+
+    // Потокобезопасно. Возвращает id сообщения или 0, если очередь переполнена.
+    // Принятое сразу попадает в кэш истории: она отдается из памяти, даже если пачка еще не записана
+    quint64 enqueue(MessageRecord record);
+
+    // Дописывает все, что осталось в очереди, и завершает поток
+    void stop();
+
+    int pending() const { return m_pending.load(std::memory_order_relaxed); }
+
+protected:
+    void run() override;
+
+private:
+    bool openStore();
+    void prepareBlobStore();
+    void flush(QList<MessageRecord> &batch);
+    void sendAcks(const QList<MessageRecord> &batch);
+
+    ServerContext *m_context;
+
+    Mailbox<MessageRecord> m_queue;
+    QSemaphore m_available;
+    QSemaphore m_ready;
+    std::atomic<int> m_pending{0};
+    std::atomic<quint64> m_nextId{1};
+    std::atomic<bool> m_stopping{false};
+    std::atomic<bool> m_opened{false};
+};
+
+#endif
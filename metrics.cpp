@@ -0,0 +1,43 @@
+#include "metrics.h"
+#include <QtAlgorithms>
+
+int Histogram::bucketFor(quint64 value)
+{
+    // До 16 — точно, дальше: номер старшего бита задает степень, следующие 4 бита — корзину в ней
+    if (value < quint64(kSubBuckets)) return int(value);
+    const int exponent = 63 - qCountLeadingZeroBits(value);
+    const int sub = int((value >> (exponent - kSubBits)) & (kSubBuckets - 1));
+    return (exponent - kSubBits + 1) * kSubBuckets + sub;
+}
+
+quint64 Histogram::bucketValue(int index)
+{
+    if (index < kSubBuckets) return quint64(index);
+    const int exponent = index / kSubBuckets + kSubBits - 1;
+    const int sub = index % kSubBuckets;
+    const quint64 width = quint64(1) << (exponent - kSubBits);
+    // Середина корзины
+    return (quint64(kSubBuckets + sub) << (exponent - kSubBits)) + width / 2;
+}
+
+void Histogram::record(qint64 nanos)
+{
+    const quint64 value = nanos > 0 ? quint64(nanos) : 0;
+    m_buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+qint64 Histogram::quantile(double q) const
+{
+    const quint64 total = count();
+    if (total == 0) return 0;
+
+    const quint64 rank = qMax<quint64>(1, quint64(q * double(total) + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return qint64(bucketValue(i));
+    }
+    return qint64(bucketValue(kBuckets - 1));
+}
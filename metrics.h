@@ -0,0 +1,117 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <chrono>
+
+// Дешевые метрики, которые можно не выключать: только relaxed-атомики, без блокировок
+
+inline qint64 monotonicNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Counter {
+public:
+    void add(quint64 n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+class Gauge {
+public:
+    void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(qint64 delta) { m_value.fetch_add(delta, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value{0};
+};
+
+// Гистограмма в духе HDR: на каждую степень двойки 16 корзин, то есть погрешность не больше ~6%
+// на всем диапазоне от наносекунд до часов. Значения — наносекунды.
+class Histogram {
+public:
+    static constexpr int kSubBits = 4;
+    static constexpr int kSubBuckets = 1 << kSubBits;
+    static constexpr int kBuckets = 64 * kSubBuckets;
+
+    void record(qint64 nanos);
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    quint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    // Приблизительный квантиль (0..1); читает без блокировок, так что на лету чуть неточен
+    qint64 quantile(double q) const;
+
+private:
+    static int bucketFor(quint64 value);
+    static quint64 bucketValue(int index);
+
+    std::array<std::atomic<quint64>, kBuckets> m_buckets{};
+    std::atomic<quint64> m_count{0};
+    std::atomic<quint64> m_sum{0};
+};
+
+// Замер участка кода: время уходит в гистограмму при выходе из области видимости
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram &histogram) : m_histogram(histogram), m_start(monotonicNanos()) {}
+    ~ScopedTimer() { m_histogram.record(monotonicNanos() - m_start); }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    Histogram &m_histogram;
+    qint64 m_start;
+};
+
+// Все метрики сервера. Живет в ServerContext; то, что можно посчитать на месте
+// (пользователи, очередь записи, кэш истории), сюда не дублируется
+struct Metrics {
+    // Соединения и трафик
+    Counter connectionsAccepted;
+    Gauge connections;
+    Counter bytesIn;
+    Counter bytesOut;
+    Gauge outboundQueuedBytes; // сумма по всем исходящим очередям
+
+    // Сообщения
+    Counter framesParsed;      // кадры и строки старого протокола
+    Counter messagesRouted;    // доставки конкретному клиенту (в т.ч. через другой шард)
+    Counter messagesPersisted;
+    Counter messagesLost;
+    Counter historyRequests;
+
+    // Файлы
+    Counter filesStored;
+    Counter fileBytesUploaded;
+    Counter fileBytesRelayed;
+
+    // Сжатое из отправленного клиентам: исходный размер и сколько ушло в сеть
+    Counter compressionInput;
+    Counter compressionOutput;
+
+    // Пульс и отключения по срокам: не прислал ник, не ответил на Ping, молчал дольше --idle-timeout
+    Counter pingsSent;
+    Counter pongsReceived;
+    Counter evictedRegistration;
+    Counter evictedHeartbeat;
+    Counter evictedIdle;
+
+    // Задержки по стадиям
+    Histogram parseLatency;        // разбор входящих байтов в кадры
+    Histogram routeLatency;        // доставка одному получателю: каталог + запись или почтовый ящик
+    Histogram persistLatency;      // один многострочный INSERT
+    Histogram persistDelay;        // от постановки в очередь до записи в БД
+    Histogram historyQueryLatency; // запрос страницы истории
+    Histogram writeLatency;        // постановка данных в исходящую очередь/сокет
+    Histogram pingRtt;             // от нашего Ping до Pong клиента
+};
+
+#endif
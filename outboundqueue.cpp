@@ -0,0 +1,155 @@
+#include "outboundqueue.h"
+#include "filetransfer.h"
+#include "server.h"
+#include <utility>
+
+namespace {
+// Сколько держим в буфере сокета, пока отдаем файл: хватает, чтобы канал не простаивал
+constexpr qint64 kFileWriteWindow = 4 * kFileChunkSize;
+}
+
+OutboundQueue::OutboundQueue(QTcpSocket *socket, const ServerConfig &config, Metrics *metrics)
+    : m_socket(socket)
+    , m_metrics(metrics)
+    , m_high(config.outHighWatermark)
+    , m_low(config.outLowWatermark)
+    , m_hard(config.outHardLimit)
+    , m_policy(config.slowConsumerPolicy)
+{
+}
+
+OutboundQueue::~OutboundQueue()
+{
+    m_metrics->outboundQueuedBytes.add(-m_reportedBytes);
+}
+
+bool OutboundQueue::write(const QByteArray &data, Kind kind)
+{
+    if (m_overflowed) return false;
+    if (m_capturing && kind == Kind::Normal) {
+        m_capture.append(data);
+        return true;
+    }
+    ScopedTimer timer(m_metrics->writeLatency);
+
+    // Медленному клиенту присутствие не шлем — потом придет полный список
+    if (kind == Kind::Presence && m_congested) {
+        ++m_stats.droppedPresence;
+        m_presenceResync = true;
+        return false;
+    }
+
+    if (m_items.empty()) {
+        // QByteArray, а не указатель: большие кадры сокет забирает без копирования
+        m_socket->write(data);
+        m_metrics->bytesOut.add(data.size());
+    } else {
+        Item item;
+        item.data = data;
+        m_pendingBytes += data.size();
+        m_items.push_back(std::move(item));
+    }
+    updateState(data.size());
+    return !m_overflowed;
+}
+
+QByteArray OutboundQueue::takeCapture()
+{
+    m_capturing = false;
+    return std::exchange(m_capture, QByteArray());
+}
+
+void OutboundQueue::writeFile(std::shared_ptr<const MappedBlob> blob, qint64 offset, qint64 length)
+{
+    if (m_overflowed) return;
+
+    Item item;
+    item.end = length < 0 ? blob->data().size() : offset + length;
+    item.offset = offset;
+    item.blob = std::move(blob);
+    m_items.push_back(std::move(item));
+    pump();
+}
+
+void OutboundQueue::pump()
+{
+    while (!m_overflowed && !m_items.empty() && m_socket->bytesToWrite() < kFileWriteWindow) {
+        Item &item = m_items.front();
+
+        if (!item.blob) {
+            m_pendingBytes -= item.data.size();
+            m_socket->write(item.data);
+            m_metrics->bytesOut.add(item.data.size());
+            m_items.pop_front();
+            continue;
+        }
+
+        const qint64 chunk = qMin(kFileChunkSize, item.end - item.offset);
+        if (chunk > 0) {
+            m_socket->write(item.blob->data().sliced(item.offset, chunk).data(), chunk);
+            item.offset += chunk;
+            m_metrics->bytesOut.add(chunk);
+        }
+        if (item.offset == item.end)
+            m_items.pop_front();
+    }
+    updateState();
+}
+
+void OutboundQueue::updateState(qint64 justWritten)
+{
+    if (m_overflowed) return;
+
+    const qint64 queued = queuedBytes();
+    m_stats.peakBytes = qMax(m_stats.peakBytes, queued);
+    m_metrics->outboundQueuedBytes.add(queued - m_reportedBytes);
+    m_reportedBytes = queued;
+
+    // Один большой кадр (старый файл из БД) пропускаем, если до него клиент успевал
+    if (queued > m_hard && queued - justWritten > m_high) {
+        overflow("hard limit exceeded");
+        return;
+    }
+
+    if (!m_congested && queued > m_high) {
+        m_congested = true;
+        ++m_stats.congestions;
+        if (m_policy == SlowConsumerPolicy::Disconnect) {
+            overflow("high watermark exceeded");
+            return;
+        }
+        if (Logger::enabled(LogLevel::Warning))
+            Server::log(Server::LogLevel::Warning, "slow_client", QString(), QString("Slow client %1: %2 bytes queued")
+                            .arg(m_socket->peerAddress().toString()).arg(queued));
+    } else if (m_congested && queued < m_low) {
+        m_congested = false;
+    }
+}
+
+// Клиент не читает — сбрасываем соединение. Не сразу: нас могли позвать из цикла по сессиям
+void OutboundQueue::overflow(const char *reason)
+{
+    if (Logger::enabled(LogLevel::Warning))
+        Server::log(Server::LogLevel::Warning, "slow_client_dropped", QString(), QString("Disconnecting %1: %2 (%3 bytes queued)")
+                        .arg(m_socket->peerAddress().toString(), QString::fromLatin1(reason)).arg(queuedBytes()));
+    m_overflowed = true;
+    m_items.clear();
+    m_pendingBytes = 0;
+    m_metrics->outboundQueuedBytes.add(-m_reportedBytes);
+    m_reportedBytes = 0;
+    QMetaObject::invokeMethod(m_socket, &QAbstractSocket::abort, Qt::QueuedConnection);
+}
+
+bool OutboundQueue::takePresenceResync()
+{
+    if (!m_presenceResync || m_congested || m_overflowed) return false;
+    m_presenceResync = false;
+    return true;
+}
+
+OutboundQueue::Stats OutboundQueue::stats() const
+{
+    Stats stats = m_stats;
+    stats.queuedBytes = queuedBytes();
+    return stats;
+}
@@ -0,0 +1,93 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QTcpSocket>
+#include <deque>
+#include <memory>
+#include "blobstore.h"
+#include "config.h"
+#include "metrics.h"
+
+// Исходящий поток одного соединения, строго по порядку.
+// Обычные записи уходят в сокет сразу; файлы из хранилища — кусками из mmap,
+// по мере того как сокет освобождается. Всё, что записано после файла, ждет его окончания.
+// Файл отображает тот, кто его ставит: пропавший файл видно до заголовка, а не посреди потока
+//
+// Очередь ограничена: буфер сокета плюс то, что ждет за файлом. Выше верхней отметки клиент
+// считается медленным (до нижней), дальше — по политике из настроек; выше hard — отключаем.
+class OutboundQueue {
+public:
+    enum class Kind {
+        Normal,
+        Presence // можно выбросить: после восстановления клиент получит полный список
+    };
+
+    struct Stats {
+        qint64 queuedBytes = 0;
+        qint64 peakBytes = 0;
+        quint64 congestions = 0;      // сколько раз переходили верхнюю отметку
+        quint64 droppedPresence = 0;
+        quint64 deferredFiles = 0;
+    };
+
+    OutboundQueue(QTcpSocket *socket, const ServerConfig &config, Metrics *metrics);
+    ~OutboundQueue();
+
+    // false — не записано (выброшено по политике или соединение уже сброшено)
+    bool write(const QByteArray &data, Kind kind = Kind::Normal);
+    // Отображенный файл целиком или его кусок [offset, offset + length)
+    void writeFile(std::shared_ptr<const MappedBlob> blob, qint64 offset = 0, qint64 length = -1);
+
+    // Обычные записи между beginCapture() и takeCapture() не уходят, а копятся в один буфер —
+    // например, чтобы сжать страницу истории целиком. writeFile() сюда не попадает
+    void beginCapture() { m_capturing = true; }
+    QByteArray takeCapture();
+
+    // По bytesWritten: дописать следующий кусок
+    void pump();
+
+    bool isIdle() const { return m_items.empty(); }
+    bool isCongested() const { return m_congested; }
+    bool isOverflowed() const { return m_overflowed; }
+    SlowConsumerPolicy policy() const { return m_policy; }
+
+    // Пропускали изменения присутствия, а теперь клиент разгребся — пора прислать список целиком
+    bool takePresenceResync();
+
+    void countDeferredFile() { ++m_stats.deferredFiles; }
+    Stats stats() const;
+
+private:
+    struct Item {
+        QByteArray data;    // общий с остальными получателями, не копируется
+        std::shared_ptr<const MappedBlob> blob; // не пусто — файл из хранилища, куски одного файла делят отображение
+        qint64 offset = 0;
+        qint64 end = 0;
+    };
+
+    qint64 queuedBytes() const { return m_socket->bytesToWrite() + m_pendingBytes; }
+    void updateState(qint64 justWritten = 0);
+    void overflow(const char *reason);
+
+    QTcpSocket *m_socket;
+    Metrics *m_metrics;
+    std::deque<Item> m_items;
+    qint64 m_pendingBytes = 0; // данные в m_items (файлы лежат на диске и не считаются)
+
+    const qint64 m_high;
+    const qint64 m_low;
+    const qint64 m_hard;
+    const SlowConsumerPolicy m_policy;
+
+    bool m_congested = false;
+    bool m_overflowed = false;
+    bool m_presenceResync = false;
+    bool m_capturing = false;
+    QByteArray m_capture;
+    Stats m_stats;
+    qint64 m_reportedBytes = 0; // наша доля в metrics->outboundQueuedBytes
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "pgstore.h"
+#include "config.h"
+#include "server.h"
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <limits>
+
+namespace {
+// PostgreSQL не принимает больше 65535 параметров в одном запросе
+constexpr int kColumns = 8;
+constexpr int kMaxRowsPerInsert = 65535 / kColumns;
+}
+
+PgStore::PgStore(const ServerConfig &config)
+    : m_config(config)
+{
+}
+
+// Подключение текущего потока (имя — имя потока: db-writer, shard-N), переподключается, если отвалилось
+QSqlDatabase PgStore::connection()
+{
+    QString connectionName = QThread::currentThread()->objectName();
+    if (connectionName.isEmpty())
+        connectionName = QString("thread-%1").arg(quintptr(QThread::currentThreadId()));
+
+    QSqlDatabase db = QSqlDatabase::contains(connectionName) ? QSqlDatabase::database(connectionName, false)
+                                                             : QSqlDatabase::addDatabase("QPSQL", connectionName);
+    if (db.isOpen()) return db;
+
+    db.setHostName(m_config.dbHost);
+    db.setDatabaseName(m_config.dbName);
+    db.setUserName(m_config.dbUser);
+    db.setPassword(m_config.dbPassword);
+
+    if (!db.open())
+    {
+        Server::log("Database connection FAILED (" + connectionName + "): " + db.lastError().text(), Server::LogLevel::Error);
+    } else {
+        Server::log("Database connection SUCCESS (" + connectionName + ")! PostgreSQL is ready.");
+    }
+    return db;
+}
+
+// Колонки для ссылок на файлы — до того, как шарды начнут принимать файлы
+bool PgStore::open()
+{
+    QSqlDatabase db = connection();
+    if (!db.isOpen()) return false;
+
+    QSqlQuery query(db);
+    if (!query.exec("ALTER TABLE messages ADD COLUMN IF NOT EXISTS blob_hash TEXT, "
+                    "ADD COLUMN IF NOT EXISTS file_size BIGINT")) {
+        Server::log("Cannot add blob columns: " + query.lastError().text(), Server::LogLevel::Error);
+    }
+    return true;
+}
+
+bool PgStore::lastId(quint64 &id)
+{
+    QSqlQuery query(connection());
+    if (query.exec("SELECT COALESCE(MAX(id), 0) FROM messages") && query.next()) {
+        id = query.value(0).toULongLong();
+        return true;
+    }
+
+    Server::log("Cannot read last message id: " + query.lastError().text(), Server::LogLevel::Error);
+    return false;
+}
+
+bool PgStore::blobRefCounts(QHash<QByteArray, int> &counts)
+{
+    QSqlDatabase db = connection();
+    if (!db.isOpen()) return false;
+
+    QSqlQuery query(db);
+    if (!query.exec("SELECT blob_hash, COUNT(*) FROM messages WHERE blob_hash IS NOT NULL GROUP BY blob_hash")) {
+        Server::log("Cannot count blob references: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+    while (query.next())
+        counts.insert(query.value(0).toByteArray(), query.value(1).toInt());
+    return true;
+}
+
+bool PgStore::append(const QList<MessageRecord> &batch)
+{
+    QSqlDatabase db = connection();
+    if (!db.transaction()) {
+        // Одна попытка переподключиться, если БД отвалилась
+        db.close();
+        db = connection();
+        if (!db.transaction()) return false;
+    }
+
+    for (qsizetype i = 0; i < batch.size(); i += kMaxRowsPerInsert) {
+        if (!insertBatch(db, batch.mid(i, kMaxRowsPerInsert))) {
+            db.rollback();
+            return false;
+        }
+    }
+    if (!advanceSequence(db, batch)) {
+        db.rollback();
+        return false;
+    }
+    return db.commit();
+}
+
+// id задаем сами, и serial колонки о них не знает. Без сдвига любой INSERT без id (старый сервер,
+// ручной запрос) получил бы уже занятый id и упал на первичном ключе
+bool PgStore::advanceSequence(QSqlDatabase &db, const QList<MessageRecord> &batch)
+{
+    quint64 maxId = 0;
+    for (const MessageRecord &record : batch) maxId = qMax(maxId, record.id);
+    if (maxId == 0) return true;
+
+    // Для колонки без последовательности pg_get_serial_sequence вернет NULL, и setval ничего не сделает
+    QSqlQuery query(db);
+    query.prepare("SELECT setval(pg_get_serial_sequence('messages', 'id'), ?)");
+    query.addBindValue(maxId);
+    if (!query.exec()) {
+        Server::log("Cannot advance message id sequence: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+    return true;
+}
+
+bool PgStore::insertBatch(QSqlDatabase &db, const QList<MessageRecord> &batch)
+{
+    // Один многострочный INSERT вместо запроса на каждое сообщение
+    QString sql = "INSERT INTO messages (id, sender, receiver, message, is_file, blob_hash, file_size, timestamp) VALUES ";
+    for (int i = 0; i < batch.size(); ++i)
+        sql += i == 0 ? "(?, ?, ?, ?, ?, ?, ?, ?)" : ", (?, ?, ?, ?, ?, ?, ?, ?)";
+
+    QSqlQuery query(db);
+    if (!query.prepare(sql)) {
+        Server::log("SQL Batch Error: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+
+    for (const MessageRecord &record : batch) {
+        query.addBindValue(record.id);
+        query.addBindValue(record.sender);
+        query.addBindValue(record.receiver);
+        query.addBindValue(record.message);
+        query.addBindValue(record.isFile);
+        query.addBindValue(record.isFile ? QVariant(QString::fromLatin1(record.blobHash)) : QVariant(QMetaType::fromType<QString>()));
+        query.addBindValue(record.isFile ? QVariant(record.fileSize) : QVariant(QMetaType::fromType<qint64>()));
+        query.addBindValue(record.timestamp);
+    }
+
+    if (!query.exec()) {
+        Server::log("SQL Batch Error: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+    return true;
+}
+
+void PgStore::close()
+{
+    connection().close();
+}
+
+// Два запроса по (sender, receiver) вместо OR — так каждая ветка идет по индексу.
+bool PgStore::loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                       QList<HistoryEntry> &entries)
+{
+    QSqlQuery query(connection());
+    if (myNick == friendNick) {
+        query.prepare("SELECT id, sender, message, timestamp, is_file, blob_hash, file_size FROM messages "
+                      "WHERE sender = :me AND receiver = :me AND id < :before "
+                      "ORDER BY id DESC LIMIT :limit");
+    } else {
+        query.prepare("SELECT id, sender, message, timestamp, is_file, blob_hash, file_size FROM ("
+                      "(SELECT id, sender, message, timestamp, is_file, blob_hash, file_size FROM messages "
+                      " WHERE sender = :me AND receiver = :friend AND id < :before ORDER BY id DESC LIMIT :limit) "
+                      "UNION ALL "
+                      "(SELECT id, sender, message, timestamp, is_file, blob_hash, file_size FROM messages "
+                      " WHERE sender = :friend AND receiver = :me AND id < :before ORDER BY id DESC LIMIT :limit)"
+                      ") AS page ORDER BY id DESC LIMIT :limit");
+        query.bindValue(":friend", friendNick);
+    }
+    query.bindValue(":me", myNick);
+    query.bindValue(":before", beforeId == 0 ? std::numeric_limits<qint64>::max() : qint64(beforeId));
+    query.bindValue(":limit", limit);
+
+    if (!query.exec()) {
+        Server::log("SQL History Error: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+
+    entries.clear();
+    while (query.next()) {
+        HistoryEntry entry;
+        entry.id = query.value(0).toULongLong();
+        entry.sender = query.value(1).toString();
+        entry.message = query.value(2).toString();
+        entry.timestamp = query.value(3).toDateTime();
+        entry.isFile = query.value(4).toBool();
+        entry.blobHash = query.value(5).toByteArray();
+        entry.fileSize = query.value(6).toLongLong();
+        entries.prepend(entry);
+    }
+    return true;
+}
+
+bool PgStore::findFile(quint64 messageId, StoredFile &file)
+{
+    QSqlQuery query(connection());
+    query.prepare("SELECT sender, receiver, message, blob_hash, file_size FROM messages "
+                  "WHERE id = :id AND is_file AND blob_hash IS NOT NULL");
+    query.bindValue(":id", qint64(messageId));
+    if (!query.exec()) {
+        Server::log("SQL Blob Error: " + query.lastError().text(), Server::LogLevel::Error);
+        return false;
+    }
+    if (!query.next()) return false;
+
+    file.sender = query.value(0).toString();
+    file.receiver = query.value(1).toString();
+    file.name = query.value(2).toString();
+    file.blobHash = query.value(3).toByteArray();
+    file.size = query.value(4).toLongLong();
+    return true;
+}
+
+QByteArray PgStore::legacyFileBody(quint64 messageId)
+{
+    QSqlQuery query(connection());
+    query.prepare("SELECT file_data FROM messages WHERE id = :id");
+    query.bindValue(":id", qint64(messageId));
+    if (!query.exec() || !query.next()) {
+        Server::log(QString("File body %1 not found").arg(messageId), Server::LogLevel::Warning);
+        return QByteArray();
+    }
+    return query.value(0).toByteArray();
+}
@@ -0,0 +1,36 @@
+#ifndef PGSTORE_H
+#define PGSTORE_H
+
+#include <QSqlDatabase>
+#include "messagestore.h"
+
+struct ServerConfig;
+
+// Таблица messages в PostgreSQL. У каждого потока свое именованное подключение —
+// QSqlDatabase нельзя делить между потоками
+class PgStore : public MessageStore {
+public:
+    explicit PgStore(const ServerConfig &config);
+
+    bool open() override;
+    bool lastId(quint64 &id) override;
+    bool blobRefCounts(QHash<QByteArray, int> &counts) override;
+    bool append(const QList<MessageRecord> &batch) override;
+    void close() override;
+
+    bool loadPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                  QList<HistoryEntry> &entries) override;
+    bool findFile(quint64 messageId, StoredFile &file) override;
+    QByteArray legacyFileBody(quint64 messageId) override;
+
+    QString name() const override { return "postgres"; }
+
+private:
+    QSqlDatabase connection();
+    bool insertBatch(QSqlDatabase &db, const QList<MessageRecord> &batch);
+    bool advanceSequence(QSqlDatabase &db, const QList<MessageRecord> &batch);
+
+    const ServerConfig &m_config;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "protocol.h"
+
+namespace Protocol {
+
+namespace {
+
+enum class VarintResult {
+    Ok,
+    NeedMore,
+    Malformed
+};
+
+// 10 байт хватает на любой quint64
+VarintResult decodeVarint(const char *&p, const char *end, quint64 &value)
+{
+    value = 0;
+    const char *cur = p;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (cur == end) return VarintResult::NeedMore;
+        const quint8 byte = static_cast<quint8>(*cur++);
+        value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            p = cur;
+            return VarintResult::Ok;
+        }
+    }
+    return VarintResult::Malformed;
+}
+
+}
+
+QByteArray preamble()
+{
+    QByteArray out(kMagic, kMagicSize);
+    out.append(char(kVersion));
+    return out;
+}
+
+void appendVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+void appendField(QByteArray &out, QByteArrayView field)
+{
+    appendVarint(out, quint64(field.size()));
+    out.append(field);
+}
+
+QByteArray encodeFrame(FrameType type, QByteArrayView payload)
+{
+    QByteArray out;
+    out.reserve(1 + 10 + payload.size());
+    out.append(char(type));
+    appendVarint(out, quint64(payload.size()));
+    out.append(payload);
+    return out;
+}
+
+QByteArray encodeFrameHeader(FrameType type, quint64 payloadSize)
+{
+    QByteArray out;
+    out.append(char(type));
+    appendVarint(out, payloadSize);
+    return out;
+}
+
+bool PayloadReader::readVarint(quint64 &value)
+{
+    const char *p = m_data.data() + m_pos;
+    const char *end = m_data.data() + m_data.size();
+    if (decodeVarint(p, end, value) != VarintResult::Ok) return false;
+    m_pos = p - m_data.data();
+    return true;
+}
+
+bool PayloadReader::readField(QByteArrayView &field)
+{
+    quint64 length = 0;
+    const qsizetype start = m_pos;
+    if (!readVarint(length)) return false;
+    if (length > quint64(m_data.size() - m_pos)) {
+        m_pos = start;
+        return false;
+    }
+    field = m_data.sliced(m_pos, qsizetype(length));
+    m_pos += qsizetype(length);
+    return true;
+}
+
+void FrameDecoder::feed(const QByteArray &data)
+{
+    if (data.isEmpty() || !m_error.isEmpty()) return;
+
+    if (m_pos >= m_buffer.size()) {
+        // Всё прошлое уже разобрано — просто разделяем буфер чтения, без копирования
+        m_buffer = data;
+        m_pos = 0;
+    } else {
+        if (m_pos > 0) {
+            m_buffer.remove(0, m_pos);
+            m_pos = 0;
+        }
+        m_buffer.append(data);
+    }
+
+    if (m_mode != Mode::Detecting) return;
+
+    // Текст никогда не начинается с \0, так что одного байта хватает, чтобы отличить старого клиента
+    if (m_buffer.at(0) != kMagic[0]) {
+        m_mode = Mode::Legacy;
+        return;
+    }
+    if (m_buffer.size() < kPreambleSize) return;
+
+    if (!m_buffer.startsWith(QByteArrayView(kMagic, kMagicSize))) {
+        fail("Bad protocol preamble");
+        return;
+    }
+    const quint8 version = static_cast<quint8>(m_buffer.at(kMagicSize));
+    if (version != kVersion) {
+        fail(QString("Unsupported protocol version %1").arg(version));
+        return;
+    }
+    m_pos = kPreambleSize;
+    m_mode = Mode::Binary;
+}
+
+FrameDecoder::Status FrameDecoder::next(Frame &frame)
+{
+    if (!m_error.isEmpty()) return Status::Error;
+    if (m_mode != Mode::Binary) return Status::NeedMore;
+
+    const char *base = m_buffer.constData();
+    const char *end = base + m_buffer.size();
+    const char *p = base + m_pos;
+    if (p == end) return Status::NeedMore;
+
+    const quint8 type = static_cast<quint8>(*p++);
+    quint64 length = 0;
+    switch (decodeVarint(p, end, length)) {
+    case VarintResult::NeedMore:
+        return Status::NeedMore;
+    case VarintResult::Malformed:
+        return fail("Malformed frame length");
+    case VarintResult::Ok:
+        break;
+    }
+
+    if (length > quint64(kMaxFrameSize))
+        return fail(QString("Frame too large: %1 bytes").arg(length));
+    if (quint64(end - p) < length) return Status::NeedMore;
+
+    frame.type = static_cast<FrameType>(type);
+    frame.payload = QByteArrayView(p, qsizetype(length));
+    m_pos = (p - base) + qsizetype(length);
+    return Status::Frame;
+}
+
+QByteArray FrameDecoder::takeLegacy()
+{
+    QByteArray out = m_pos > 0 ? m_buffer.mid(m_pos) : m_buffer;
+    m_buffer.clear();
+    m_pos = 0;
+    return out;
+}
+
+FrameDecoder::Status FrameDecoder::fail(const QString &error)
+{
+    m_error = error;
+    m_buffer.clear();
+    m_pos = 0;
+    return Status::Error;
+}
+
+}
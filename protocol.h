@@ -0,0 +1,144 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+
+// Бинарный протокол v1.
+// Клиент открывает соединение преамбулой "\0MSG" + байт версии, дальше идут кадры:
+//   [тип: 1 байт][длина payload: varint (LEB128)][payload]
+// Текстовый протокол (всё, что не начинается с \0) пока остается для старых клиентов.
+namespace Protocol {
+
+inline constexpr char kMagic[] = {'\0', 'M', 'S', 'G'};
+inline constexpr int kMagicSize = 4;
+inline constexpr quint8 kVersion = 1;
+inline constexpr int kPreambleSize = kMagicSize + 1;
+
+inline constexpr qsizetype kMaxFrameSize = 16 * 1024 * 1024;
+inline constexpr qsizetype kMaxTextSize = 64 * 1024;
+
+enum class FrameType : quint8 {
+    Text    = 0x01, // UTF-8 строка, те же команды и ответы, что и в текстовом протоколе (без \n)
+    File    = 0x02, // клиент -> сервер: [поле: получатель][поле: имя файла][байты файла]
+    FileRec = 0x03, // сервер -> клиент: [поле: отправитель][поле: имя файла][байты файла]
+
+    // Потоковая передача. Клиент -> сервер:
+    //   FileBegin [varint id][поле: получатель][поле: имя][varint размер] -> ответ FileAck [varint id][varint смещение]
+    //   FileChunk [varint id][байты] — шлем начиная со смещения из FileAck (докачка)
+    //   FileEnd   [varint id][varint статус] — отмена загрузки
+    // Сервер -> получателю то же самое, только в FileBegin вместо получателя отправитель,
+    // а FileEnd приходит всегда и говорит, чем все закончилось.
+    FileBegin = 0x04,
+    FileChunk = 0x05,
+    FileEnd   = 0x06,
+    FileAck   = 0x07,
+
+    // Сервер -> клиент: [varint id] — сообщение записано в БД.
+    // Подтверждения идут в том же порядке, в каком клиент слал сообщения и файлы.
+    Ack       = 0x08,
+
+    // Сервер -> клиент: изменения списка пользователей, "+ник,-ник,...".
+    // Полный список (USERS_LIST в Text) приходит после входа и после того, как медленному
+    // клиенту пропускали изменения.
+    Presence  = 0x09,
+
+    // Сервер -> клиент: файл из истории без содержимого —
+    //   [varint id сообщения][поле: отправитель][поле: имя файла][varint размер][поле: SHA-256 hex]
+    FileRef   = 0x0A,
+    // Клиент -> сервер: [varint id сообщения] — прислать сам файл. Ответ — обычный FileRec,
+    // ответы идут в том же порядке, что и запросы. Файл, который не влезает в один кадр (kMaxFrameSize),
+    // здесь и везде, где обещан FileRec, приходит потоком FileBegin/FileChunk/FileEnd с новым id.
+    BlobGet   = 0x0B,
+
+    // Сжатие. Клиент сразу после преамбулы, до ника: Hello [varint маска алгоритмов, бит 1 << алгоритм];
+    // сервер отвечает Hello [varint выбранный алгоритм] (0 — без сжатия). Нет Hello — нет сжатия.
+    // Дальше сервер может прислать вместо обычных кадров сжатые (маленькие и несжимаемые идут как есть):
+    //   Compressed          [varint алгоритм][varint исходный размер][данные] — внутри подряд обычные кадры
+    //   CompressedFileRec   [поле: отправитель][поле: имя файла][varint алгоритм][varint размер][данные]
+    //   CompressedFileChunk [varint id][varint алгоритм][varint размер][данные]
+    Hello               = 0x0C,
+    Compressed          = 0x0D,
+    CompressedFileRec   = 0x0E,
+    CompressedFileChunk = 0x0F,
+
+    // Пульс, в обе стороны: Ping [varint метка] -> Pong [та же метка]. Сервер шлет Ping бинарному
+    // клиенту, который молчит дольше --ping-interval, и отключает, если ответа нет за --ping-timeout.
+    // Клиент тоже может слать Ping — сервер отвечает Pong. Метка для получателя непрозрачна.
+    Ping                = 0x10,
+    Pong                = 0x11
+};
+
+enum class FileStatus : quint8 {
+    Ok      = 0,
+    Aborted = 1,
+    Failed  = 2,
+    Deferred = 3  // получатель не успевал: пересылка прервана, файл придет позже целиком (FileRec)
+};
+
+struct Frame {
+    FrameType type = FrameType::Text;
+    QByteArrayView payload; // смотрит в буфер декодера, живет до следующего feed()
+};
+
+QByteArray preamble();
+
+void appendVarint(QByteArray &out, quint64 value);
+void appendField(QByteArray &out, QByteArrayView field);
+QByteArray encodeFrame(FrameType type, QByteArrayView payload);
+// Только заголовок: payload допишет вызывающий (например, файл прямо с диска)
+QByteArray encodeFrameHeader(FrameType type, quint64 payloadSize);
+
+// Последовательное чтение полей из payload кадра
+class PayloadReader {
+public:
+    explicit PayloadReader(QByteArrayView payload) : m_data(payload) {}
+
+    bool readVarint(quint64 &value);
+    bool readField(QByteArrayView &field);
+    QByteArrayView rest() const { return m_data.sliced(m_pos); }
+
+private:
+    QByteArrayView m_data;
+    qsizetype m_pos = 0;
+};
+
+// Возобновляемый декодер: принимает байты любыми порциями, отдает 0..N готовых кадров.
+// Кадры не копируются — payload указывает прямо в накопленный буфер.
+class FrameDecoder {
+public:
+    enum class Mode {
+        Detecting,
+        Legacy,
+        Binary
+    };
+
+    enum class Status {
+        NeedMore,
+        Frame,
+        Error
+    };
+
+    Mode mode() const { return m_mode; }
+    QString errorString() const { return m_error; }
+    qsizetype bufferedBytes() const { return m_buffer.size() - m_pos; }
+
+    void feed(const QByteArray &data);
+    Status next(Frame &frame);
+
+    // Только для Legacy: забрать всё накопленное как есть
+    QByteArray takeLegacy();
+
+private:
+    Status fail(const QString &error);
+
+    QByteArray m_buffer;
+    qsizetype m_pos = 0;
+    Mode m_mode = Mode::Detecting;
+    QString m_error;
+};
+
+}
+
+#endif
@@ -1,77 +1,469 @@
 #include "server.h"
+#include "servercontext.h"
+#include "messagewriter.h"
+#include "messagestore.h"
+#include "statsserver.h"
 #include <QStringList>
 #include <QDateTime>
 
-Server::Server(QObject *parent) : QObject(parent)
+namespace {
+
+// Ссылка на файл в хранилище: ее же получают клиенты в истории (кадр FileRef)
+QByteArray fileRefPayload(quint64 messageId, const QString &sender, const QString &fileName,
+                          qint64 size, const QByteArray &hash)
+{
+    QByteArray payload;
+    Protocol::appendVarint(payload, messageId);
+    Protocol::appendField(payload, sender.toUtf8());
+    Protocol::appendField(payload, fileName.toUtf8());
+    Protocol::appendVarint(payload, quint64(size));
+    Protocol::appendField(payload, hash);
+    return payload;
+}
+
+// Файл отображаем до заголовка: пропал или не того размера — заголовок с размером слать нельзя
+std::shared_ptr<const MappedBlob> mapBlob(const QString &path, qint64 size)
 {
-    m_server = new QTcpServer(this);
-    m_startTime = QDateTime::currentDateTime();
+    auto blob = std::make_shared<MappedBlob>();
+    if (!blob->open(path) || blob->data().size() != size) return nullptr;
+    return blob;
+}
 
-    initDb();
+}
 
-    connect(m_server, &QTcpServer::newConnection, this, &Server::onNewConnection);
+Server::Server(int shardId, ServerContext *context, QObject *parent)
+    : QObject(parent)
+    , m_shardId(shardId)
+    , m_context(context)
+{
+    m_uploadSweepTimer = new QTimer(this);
+    connect(m_uploadSweepTimer, &QTimer::timeout, this, &Server::sweepUploads);
+
+    // Вход/выход склеиваем в одну рассылку раз в 50 мс
+    m_presenceTimer = new QTimer(this);
+    m_presenceTimer->setSingleShot(true);
+    m_presenceTimer->setInterval(50);
+    connect(m_presenceTimer, &QTimer::timeout, this, &Server::flushPresence);
+
+    // Один QTimer на шард крутит колесо, вместо таймера на каждый сокет
+    m_tickTimer = new QTimer(this);
+    m_tickTimer->setTimerType(Qt::CoarseTimer);
+    m_tickTimer->setInterval(m_timers.tickMs());
+    connect(m_tickTimer, &QTimer::timeout, this, &Server::tickTimers);
+}
+
+// Уже в своем потоке: таймеры должны создаваться здесь
+void Server::start()
+{
+    m_uploadSweepTimer->start(5000);
+    m_clock.start();
+    m_tickTimer->start();
+}
 
-    if (m_server->listen(QHostAddress::Any, 1234))
-        log("Server started on port 1234");
+void Server::shutdown()
+{
+    m_shuttingDown = true;
+    m_uploadSweepTimer->stop();
+    m_presenceTimer->stop();
+    m_tickTimer->stop();
+
+    // Сокеты удалятся тут же, в конце потока (deleteLater), вместе с сессиями
+    const QList<QTcpSocket*> sockets = m_sessions.keys();
+    for (QTcpSocket *socket : sockets) socket->abort();
+    if (Logger::enabled(LogLevel::Info))
+        log(QString("Shard %1 stopped, %2 connections closed").arg(m_shardId).arg(sockets.size()));
+}
+
+void Server::tickTimers()
+{
+    // Часы, а не число срабатываний: QTimer мог опоздать или пропустить тики
+    m_timers.advanceTo(m_clock.elapsed(), [this](TimerWheel::Timer *timer) {
+        onSessionTimer(static_cast<Session*>(timer->owner()));
+    });
+}
+
+void Server::post(Envelope envelope)
+{
+    m_mailbox.push(std::move(envelope));
+    // Будим шард один раз на пачку, а не на каждое сообщение
+    if (!m_drainScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, &Server::drainMailbox, Qt::QueuedConnection);
+}
+
+void Server::drainMailbox()
+{
+    m_drainScheduled.store(false);
 
+    Envelope envelope;
+    while (m_mailbox.pop(envelope))
+        deliverLocal(envelope);
+}
+
+// Изменение присутствия ("+ник" / "-ник") уходит всем шардам, там копится и
+// рассылается пачкой по таймеру — вместо полного списка на каждый вход/выход
+void Server::broadcastPresence(const QString &delta)
+{
+    Envelope envelope;
+    envelope.type = Protocol::FrameType::Presence;
+    envelope.payload = delta.toUtf8();
+    for (Server *shard : m_context->shards)
+    {
+        if (shard == this) deliverLocal(envelope);
+        else shard->post(envelope);
+    }
+}
+
+void Server::queuePresence(const QString &delta)
+{
+    const QString nick = delta.mid(1);
+    // Вошел и сразу вышел за одну пачку — для клиентов ничего не изменилось
+    if (m_presenceDeltas.contains(nick) && m_presenceDeltas.value(nick) != delta.at(0))
+        m_presenceDeltas.remove(nick);
     else
-        log("Server failed to start!", LogLevel::Error);
+        m_presenceDeltas.insert(nick, delta.at(0));
+    m_presenceChanged = true;
+
+    if (!m_presenceTimer->isActive())
+        m_presenceTimer->start();
+}
+
+void Server::flushPresence()
+{
+    if (!m_presenceChanged) return;
+    m_presenceChanged = false;
+
+    QStringList deltas;
+    deltas.reserve(m_presenceDeltas.size());
+    for (auto it = m_presenceDeltas.cbegin(); it != m_presenceDeltas.cend(); ++it)
+        deltas.append(it.value() + it.key());
+    m_presenceDeltas.clear();
+
+    const QByteArray deltaFrame = Protocol::encodeFrame(Protocol::FrameType::Presence, deltas.join(",").toUtf8());
+    // Старые клиенты понимают только полный список и строки "вошел/покинул" — собираем их один раз на пачку
+    QByteArray legacyNotices;
+    QByteArray legacyList;
+
+    for (Session *session : std::as_const(m_byNick)) {
+        if (session->isBinary()) {
+            if (!deltas.isEmpty()) session->outbound().write(deltaFrame, OutboundQueue::Kind::Presence);
+            continue;
+        }
+        if (legacyList.isEmpty()) {
+            for (const QString &delta : std::as_const(deltas)) {
+                const QString action = delta.at(0) == '+' ? "вошел в чат" : "покинул чат";
+                legacyNotices += ("SYSTEM: Пользователь [" + delta.mid(1) + "] " + action + "\n").toUtf8();
+            }
+            legacyList = ("USERS_LIST:" + m_context->directory.nicks().join(",") + "\n").toUtf8();
+        }
+        if (!legacyNotices.isEmpty()) session->outbound().write(legacyNotices);
+        session->outbound().write(legacyList, OutboundQueue::Kind::Presence);
+    }
 }
 
-// Функция рассылки списка имен всем подключенным
-void Server::broadcastUserList()
+// Полный список — только один раз, сразу после входа
+void Server::sendUserList(Session *session)
 {
-    QStringList users = m_clients.keys();
-    sendToAll("USERS_LIST:" + users.join(","));
+    sendText(session, "USERS_LIST:" + m_context->directory.nicks().join(","));
 }
 
-void Server::onNewConnection()
+void Server::addConnection(qintptr socketDescriptor)
 {
-    QTcpSocket *socket = m_server->nextPendingConnection();
+    auto *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        log("Cannot adopt socket: " + socket->errorString(), LogLevel::Error);
+        delete socket;
+        return;
+    }
+    // Ограничиваем буфер чтения: большие файлы идут потоком, а не копятся в памяти
+    socket->setReadBufferSize(kSocketReadBufferSize);
+    // Старые клиенты не умеют Ping — мертвое соединение без простоя находит только ядро
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+
+    // Сессия живет ровно столько же, сколько сокет (удаляется вместе с deleteLater)
+    m_sessions.insert(socket, new Session(socket, m_context->config, &m_context->metrics));
+    m_context->metrics.connectionsAccepted.add();
+    m_context->metrics.connections.add(1);
+    connect(socket, &QObject::destroyed, this, [this, socket]() {
+        delete m_sessions.take(socket);
+        m_context->metrics.connections.add(-1);
+    });
 
     connect(socket, &QTcpSocket::readyRead, this, &Server::onReadyRead);
+    connect(socket, &QTcpSocket::bytesWritten, this, &Server::onBytesWritten);
     connect(socket, &QTcpSocket::disconnected, this, &Server::onDisconnected);
-    log("New attempt of connection...");
+
+    // Кто подключился и не прислал ник — не держим вечно
+    Session *session = m_sessions.value(socket);
+    session->setLastActivity(m_timers.now());
+    if (m_context->config.registerTimeoutMs > 0)
+        m_timers.schedule(&session->timer(), m_context->config.registerTimeoutMs);
+    if (Logger::enabled(LogLevel::Info))
+        log("New attempt of connection...");
 }
 
 void Server::onReadyRead()
 {
-    auto *socket = qobject_cast<QTcpSocket*>(sender());
-    if (!socket) return;
+    Session *session = m_sessions.value(qobject_cast<QTcpSocket*>(sender()));
+    if (!session) return;
 
-    // QString data = QString::fromUtf8(socket->readAll()).trimmed();
-    QByteArray rawData = socket->readAll();
+    QByteArray rawData = session->socket()->readAll();
     if (rawData.isEmpty()) return;
 
-    if (rawData.startsWith("FILE:")) {
-        handleFileTransfer(socket, rawData);
+    Metrics &metrics = m_context->metrics;
+    metrics.bytesIn.add(rawData.size());
+    // Любые входящие байты — признак жизни; таймер не трогаем, он сам проверит это при срабатывании
+    session->setLastActivity(m_timers.now());
+
+    Protocol::FrameDecoder &decoder = session->decoder();
+    const bool wasBinary = session->isBinary();
+    qint64 parseStart = monotonicNanos();
+    decoder.feed(rawData);
+
+    if (decoder.mode() == Protocol::FrameDecoder::Mode::Legacy) {
+        metrics.parseLatency.record(monotonicNanos() - parseStart);
+        metrics.framesParsed.add();
+        handleLegacyData(session, decoder.takeLegacy());
+        return;
+    }
+
+    if (!wasBinary && session->isBinary())
+        session->outbound().write(Protocol::preamble());
+
+    // Разбираем все целые кадры, что пришли за одно чтение. В замер разбора идет только декодер
+    Protocol::Frame frame;
+    Protocol::FrameDecoder::Status status;
+    while ((status = decoder.next(frame)) == Protocol::FrameDecoder::Status::Frame) {
+        metrics.parseLatency.record(monotonicNanos() - parseStart);
+        metrics.framesParsed.add();
+        handleFrame(session, frame);
+        if (session->state() == Session::State::Closing) return;
+        parseStart = monotonicNanos();
+    }
+
+    if (status == Protocol::FrameDecoder::Status::Error) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Protocol error: " + decoder.errorString(), LogLevel::Warning);
+        closeSession(session);
+    }
+}
+
+// Сокет освободился — дописываем файлы, которые ждут в очереди
+void Server::onBytesWritten()
+{
+    Session *session = m_sessions.value(qobject_cast<QTcpSocket*>(sender()));
+    if (!session) return;
+
+    // Само по себе не признак жизни (ядро берет данные и у мертвого), но Ping может стоять за файлом
+    session->setLastDrain(m_timers.now());
+    session->outbound().pump();
+    // Пока клиент не успевал, изменения присутствия выбрасывались — шлем список целиком
+    if (session->isRegistered() && session->outbound().takePresenceResync())
+        sendUserList(session);
+}
+
+// Старый текстовый протокол: одно чтение = одно сообщение (или очередной кусок файла)
+void Server::handleLegacyData(Session *session, const QByteArray &rawData)
+{
+    QByteArrayView rest(rawData);
+
+    // Идет загрузка файла — всё пришедшее это его тело
+    if (FileUpload *upload = session->uploads().value(kLegacyTransferId)) {
+        const qint64 taken = feedUpload(session, upload, rest);
+        if (taken < 0) return;
+        rest = rest.sliced(taken);
+    }
+    if (rest.isEmpty()) return;
+
+    if (rest.startsWith("FILE:")) {
+        handleFileTransfer(session, rest);
     } else {
-        QString textData = QString::fromUtf8(rawData).trimmed();
+        QString textData = QString::fromUtf8(rest).trimmed();
         // Если это не пустой мусор - обрабатываем как текст
         if (!textData.isEmpty() && textData.length() < 1000) {
-            handleTextMessage(socket, textData);
+            handleTextMessage(session, textData);
         }
     }
+}
 
+void Server::handleFrame(Session *session, const Protocol::Frame &frame)
+{
+    switch (frame.type) {
+    case Protocol::FrameType::Text: {
+        if (frame.payload.size() > Protocol::kMaxTextSize) {
+            if (Logger::enabled(LogLevel::Warning))
+                log("Text frame too large, dropped", LogLevel::Warning);
+            return;
+        }
+        QString textData = QString::fromUtf8(frame.payload).trimmed();
+        if (!textData.isEmpty())
+            handleTextMessage(session, textData);
+        return;
+    }
+    case Protocol::FrameType::File: {
+        if (!session->isRegistered()) return;
+
+        Protocol::PayloadReader reader(frame.payload);
+        QByteArrayView target, fileName;
+        if (!reader.readField(target) || !reader.readField(fileName)) {
+            if (Logger::enabled(LogLevel::Warning))
+                log("Malformed FILE frame", LogLevel::Warning);
+            return;
+        }
+        storeAndRelayFile(session, QString::fromUtf8(target), QString::fromUtf8(fileName),
+                          reader.rest().toByteArray());
+        return;
+    }
+    case Protocol::FrameType::FileBegin:
+        if (session->isRegistered()) handleFileBegin(session, frame);
+        return;
+    case Protocol::FrameType::FileChunk:
+        handleFileChunk(session, frame);
+        return;
+    case Protocol::FrameType::FileEnd:
+        handleFileEnd(session, frame);
+        return;
+    case Protocol::FrameType::BlobGet:
+        if (session->isRegistered()) handleBlobGet(session, frame);
+        return;
+    case Protocol::FrameType::Hello:
+        handleHello(session, frame);
+        return;
+    case Protocol::FrameType::Ping:
+        handlePing(session, frame);
+        return;
+    case Protocol::FrameType::Pong:
+        handlePong(session, frame);
+        return;
+    default:
+        if (Logger::enabled(LogLevel::Warning))
+            log(QString("Unknown frame type %1, ignored").arg(int(frame.type)), LogLevel::Warning);
+        return;
+    }
 }
 
 void Server::onDisconnected()
 {
     auto *socket = qobject_cast<QTcpSocket*>(sender());
-    QString name = m_clients.key(socket);
-    if (!name.isEmpty())
+    Session *session = m_sessions.value(socket);
+    if (!session) return;
+
+    // Оборванные загрузки: бинарный клиент сможет докачать, текстовый — нет
+    const QHash<quint64, FileUpload*> uploads = session->uploads();
+    for (FileUpload *upload : uploads) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Upload interrupted: " + upload->fileName() + " from " + upload->sender(), LogLevel::Warning);
+        abortUpload(session, upload, session->isBinary());
+    }
+
+    const bool wasRegistered = session->isRegistered();
+    session->setClosing();
+    m_timers.cancel(&session->timer());
+
+    QString name = session->nick();
+    if (wasRegistered)
     {
-        m_clients.remove(name);
-        sendToAll("SYSTEM: Пользователь [" + name + "] покинул чат");
-        broadcastUserList();
-        log("User disconnected: " + name);
+        m_byNick.remove(name);
+        m_context->directory.remove(name, session);
+        // При остановке уходят все сразу — рассылать некому
+        if (!m_shuttingDown) broadcastPresence("-" + name);
+        if (Logger::enabled(LogLevel::Info))
+            log(LogLevel::Info, "disconnect", name, "User disconnected");
     }
     socket->deleteLater();
 }
 
+void Server::closeSession(Session *session)
+{
+    session->setClosing();
+    session->socket()->disconnectFromHost();
+}
+
+// Следующая проверка — по ближайшему из сроков: ответ на Ping, очередной Ping, простой.
+// Старых клиентов по простою не гоняем: в тихом чате им нечего ни слать, ни забирать
+void Server::armSessionTimer(Session *session)
+{
+    const ServerConfig &config = m_context->config;
+    const qint64 now = m_timers.now();
+    qint64 next = -1;
+    const auto earliest = [&next](qint64 at) {
+        if (next < 0 || at < next) next = at;
+    };
+
+    if (session->pingSentAt() >= 0)
+        earliest(session->pingSentAt() + config.pingTimeoutMs);
+    else if (session->isBinary() && config.pingIntervalMs > 0)
+        earliest(session->lastActivity() + config.pingIntervalMs);
+    if (session->isBinary() && config.idleTimeoutMs > 0)
+        earliest(session->lastSeen() + config.idleTimeoutMs);
+
+    if (next < 0) m_timers.cancel(&session->timer());
+    else m_timers.schedule(&session->timer(), next - now);
+}
+
+void Server::onSessionTimer(Session *session)
+{
+    const ServerConfig &config = m_context->config;
+    Metrics &metrics = m_context->metrics;
+
+    // Сами закрыли (отказ в нике), а клиент не уходит — дорываем без счетчиков
+    if (session->state() == Session::State::Closing) {
+        session->socket()->abort();
+        return;
+    }
+    if (!session->isRegistered()) {
+        evict(session, metrics.evictedRegistration, "registration_timeout",
+              QString("No nickname within %1 s").arg(config.registerTimeoutMs / 1000));
+        return;
+    }
+
+    const qint64 now = m_timers.now();
+    const qint64 silence = now - session->lastActivity();
+    const qint64 idle = now - session->lastSeen();
+    if (session->isBinary() && config.idleTimeoutMs > 0 && idle >= config.idleTimeoutMs) {
+        evict(session, metrics.evictedIdle, "idle_timeout", QString("Idle for %1 s").arg(idle / 1000));
+        return;
+    }
+
+    if (session->pingSentAt() >= 0) {
+        // Pong мог задержаться за другими кадрами — любые данные после Ping тоже ответ
+        if (session->lastActivity() > session->pingSentAt()) {
+            session->setPingSentAt(-1);
+        } else if (session->lastDrain() > session->pingSentAt()
+                   && (!session->outbound().isIdle() || session->socket()->bytesToWrite() > 0)) {
+            // Ping еще в очереди за другими данными, а они уходят — даем клиенту дочитать до него
+            session->setPingSentAt(now);
+        } else if (now - session->pingSentAt() >= config.pingTimeoutMs) {
+            evict(session, metrics.evictedHeartbeat, "heartbeat_timeout",
+                  QString("No pong within %1 s").arg(config.pingTimeoutMs / 1000));
+            return;
+        }
+    }
+
+    if (session->pingSentAt() < 0 && session->isBinary() && config.pingIntervalMs > 0
+        && silence >= config.pingIntervalMs) {
+        QByteArray payload;
+        Protocol::appendVarint(payload, quint64(monotonicNanos()));
+        session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::Ping, payload));
+        session->setPingSentAt(now);
+        metrics.pingsSent.add();
+    }
+    armSessionTimer(session);
+}
+
+// Полуоткрытый сокет может не отдать данные никогда — рвем сразу, без disconnectFromHost.
+// Выход из чата и рассылки делает onDisconnected, как при обычном обрыве
+void Server::evict(Session *session, Counter &counter, const QString &reason, const QString &message)
+{
+    counter.add();
+    const QString peer = session->socket()->peerAddress().toString();
+    if (Logger::enabled(LogLevel::Warning))
+        log(LogLevel::Warning, "evict_" + reason, session->nick(), message + ", peer " + peer);
+    session->socket()->abort();
+}
+
 QString Server::getUptime() const
 {
-    quint64 secs = m_startTime.secsTo(QDateTime::currentDateTime());
+    quint64 secs = m_context->startTime.secsTo(QDateTime::currentDateTime());
 
     int hours = secs / 3600;
     int mins = (secs % 3600) / 60;
@@ -90,158 +482,804 @@ bool Server::isValidName(const QString &name)
     return true;
 }
 
-void Server::sendToAll(const QString &message)
+// Клиент может быть на любом шарде: свой пишем сразу, чужой — через его почтовый ящик
+bool Server::deliver(const QString &nick, Protocol::FrameType type, const QByteArray &payload)
 {
-    QByteArray data = (message + "\n").toUtf8();
-    for(auto *socket : m_clients.values())
-    {
-        socket->write(data);
+    ScopedTimer timer(m_context->metrics.routeLatency);
+    UserDirectory::Entry entry;
+    if (!m_context->directory.lookup(nick, entry)) return false;
+
+    m_context->metrics.messagesRouted.add();
+    Envelope envelope{nick, type, payload};
+    if (entry.shard == this) deliverLocal(envelope);
+    else entry.shard->post(std::move(envelope));
+    return true;
+}
+
+void Server::deliverLocal(const Envelope &envelope)
+{
+    if (envelope.type == Protocol::FrameType::Presence) {
+        queuePresence(QString::fromUtf8(envelope.payload));
+        return;
+    }
+
+    if (envelope.target.isEmpty()) {
+        // Кодируем один раз на оба протокола, дальше только раздаем
+        const QByteArray frame = Protocol::encodeFrame(envelope.type, envelope.payload);
+        const QByteArray legacy = envelope.payload + "\n";
+        for (Session *session : std::as_const(m_byNick))
+            session->outbound().write(session->isBinary() ? frame : legacy);
+        return;
+    }
+
+    Session *session = m_byNick.value(envelope.target);
+    if (!session) return; // успел отключиться
+
+    // Файл из хранилища: обоим протоколам целиком, но прямо с диска, а не через почтовый ящик
+    if (envelope.type == Protocol::FrameType::FileRef) {
+        Protocol::PayloadReader reader(envelope.payload);
+        quint64 messageId = 0, size = 0;
+        QByteArrayView sender, fileName, hash;
+        if (reader.readVarint(messageId) && reader.readField(sender) && reader.readField(fileName) &&
+            reader.readVarint(size) && reader.readField(hash))
+            sendBlob(session, QString::fromUtf8(sender), QString::fromUtf8(fileName), hash.toByteArray(), qint64(size));
+        return;
+    }
+
+    switch (envelope.type) {
+    case Protocol::FrameType::FileBegin:
+    case Protocol::FrameType::FileChunk:
+    case Protocol::FrameType::CompressedFileChunk:
+    case Protocol::FrameType::FileEnd:
+        deliverRelay(session, envelope);
+        return;
+    default:
+        break;
+    }
+
+    if (session->isBinary()) {
+        session->outbound().write(Protocol::encodeFrame(envelope.type, envelope.payload));
+        return;
+    }
+
+    // Старому клиенту переводим обратно в текстовый протокол
+    switch (envelope.type) {
+    case Protocol::FrameType::Text:
+        session->outbound().write(envelope.payload + "\n");
+        break;
+    default:
+        break; // потоковые кадры старым клиентам не шлем
     }
-    log("Broadcast: " + message);
 }
 
-void Server::log(const QString &message, LogLevel level)
+// Живая пересылка файла бинарному клиенту. Если он не успевает принимать (и политика позволяет),
+// куски больше не копим: пересылку прерываем, а файл потом отдаем целиком из хранилища —
+// очередь читает его с диска в темпе клиента
+void Server::deliverRelay(Session *session, const Envelope &envelope)
+{
+    if (!session->isBinary()) return; // потоковые кадры старым клиентам не шлем
+
+    Protocol::PayloadReader reader(envelope.payload);
+    quint64 relayId = 0;
+    if (!reader.readVarint(relayId)) return;
+
+    OutboundQueue &outbound = session->outbound();
+    QSet<quint64> &deferred = session->deferredRelays();
+
+    if (envelope.type == Protocol::FrameType::FileEnd) {
+        quint64 status = 0;
+        if (!reader.readVarint(status)) return;
+
+        if (!deferred.remove(relayId)) {
+            // Клиенту — только [id][статус], ссылка на файл в конце нужна лишь для отложенных
+            QByteArray payload;
+            Protocol::appendVarint(payload, relayId);
+            Protocol::appendVarint(payload, status);
+            outbound.write(Protocol::encodeFrame(Protocol::FrameType::FileEnd, payload));
+            return;
+        }
+
+        quint64 messageId = 0, size = 0;
+        QByteArrayView sender, fileName, hash;
+        if (status == quint64(Protocol::FileStatus::Ok) && reader.readVarint(messageId) &&
+            reader.readField(sender) && reader.readField(fileName) && reader.readVarint(size) && reader.readField(hash))
+            sendBlob(session, QString::fromUtf8(sender), QString::fromUtf8(fileName), hash.toByteArray(), qint64(size));
+        return;
+    }
+
+    if (deferred.contains(relayId)) return;
+
+    const bool defer = outbound.isCongested() && outbound.policy() >= SlowConsumerPolicy::DeferFiles;
+    if (!defer) {
+        outbound.write(Protocol::encodeFrame(envelope.type, envelope.payload));
+        return;
+    }
+
+    deferred.insert(relayId);
+    outbound.countDeferredFile();
+    if (Logger::enabled(LogLevel::Warning))
+        log(LogLevel::Warning, "relay_deferred", session->nick(), QString("Relay %1 deferred: client is slow").arg(relayId));
+
+    // Начало клиент уже видел — говорим, что этот поток закончен, файл придет отдельно
+    if (envelope.type != Protocol::FrameType::FileBegin) {
+        QByteArray payload;
+        Protocol::appendVarint(payload, relayId);
+        Protocol::appendVarint(payload, quint64(Protocol::FileStatus::Deferred));
+        outbound.write(Protocol::encodeFrame(Protocol::FrameType::FileEnd, payload));
+    }
+}
+
+void Server::sendText(Session *session, const QString &text)
+{
+    if (session->isBinary())
+        session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::Text, text.toUtf8()));
+    else
+        session->outbound().write((text + "\n").toUtf8());
+}
+
+void Server::sendFile(Session *session, const QString &sender, const QString &fileName, const QByteArray &fileBytes)
 {
-    QString prefix = "[INFO]";
-    if (level == LogLevel::Warning) prefix = "[WARN]";
-    if (level == LogLevel::Error)   prefix = "[ERR!]";
+    if (session->isBinary()) {
+        QByteArray payload;
+        Protocol::appendField(payload, sender.toUtf8());
+        Protocol::appendField(payload, fileName.toUtf8());
+        payload.append(fileBytes);
+        session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::FileRec, payload));
+        return;
+    }
 
-    QString time = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
-    qDebug() << QString("%1 %2 %3").arg(time, prefix, message).toUtf8().constData();
+    // Формируем наш стандартный пакет FILE_REC:от_кого:имя:размер:байты
+    QByteArray filePacket = "FILE_REC:" + sender.toUtf8() + ":" +
+                            fileName.toUtf8() + ":" +
+                            QByteArray::number(fileBytes.size()) + ":" +
+                            fileBytes;
+    session->outbound().write(filePacket);
 }
 
-void Server::initDb()
+// Тот же FILE_REC / FileRec, только тело не читаем в память: заголовок сразу,
+// а байты очередь отдает кусками из отображенного файла.
+// Файла нет (выброшен по сроку хранения) — говорим об этом, соединение не трогаем
+void Server::sendBlob(Session *session, const QString &sender, const QString &fileName,
+                      const QByteArray &hash, qint64 size)
 {
-    m_db = QSqlDatabase::addDatabase("QPSQL");
-    m_db.setHostName("localhost");
-    m_db.setDatabaseName("messenger_db");
-    m_db.setUserName("postgres");
-    m_db.setPassword("MY_RRRITK2");
+    const std::shared_ptr<const MappedBlob> blob = mapBlob(m_context->blobs.path(hash), size);
+    if (!blob) {
+        if (Logger::enabled(LogLevel::Warning))
+            log(LogLevel::Warning, "blob_missing", session->nick(), "Attachment is gone: " + fileName);
+        sendText(session, "SYSTEM: File " + fileName + " is no longer available.");
+        return;
+    }
 
-    if (!m_db.open())
-    {
-        log("Database connection FAILED: " + m_db.lastError().text(), LogLevel::Error);
+    QByteArray header;
+    if (session->isBinary()) {
+        QByteArray fields;
+        Protocol::appendField(fields, sender.toUtf8());
+        Protocol::appendField(fields, fileName.toUtf8());
+
+        // Сжатая копия считается один раз на файл в фоне и дальше отдается всем так же, из mmap;
+        // пока ее нет — шлем как есть
+        const Compression::Algorithm algorithm = session->compression();
+        if (algorithm != Compression::Algorithm::None && size >= m_context->config.compressionMinSize
+            && !Compression::isPrecompressedName(fileName)) {
+            qint64 packedSize = 0;
+            const QString packedPath = m_context->blobs.packed(hash, algorithm, packedSize);
+            const std::shared_ptr<const MappedBlob> packed = packedPath.isEmpty() ? nullptr : mapBlob(packedPath, packedSize);
+            if (packed) {
+                Protocol::appendVarint(fields, quint64(algorithm));
+                Protocol::appendVarint(fields, quint64(size));
+                session->outbound().write(Protocol::encodeFrameHeader(Protocol::FrameType::CompressedFileRec,
+                                                                      quint64(fields.size() + packedSize)) + fields);
+                session->outbound().writeFile(packed);
+                m_context->metrics.compressionInput.add(size);
+                m_context->metrics.compressionOutput.add(packedSize);
+                return;
+            }
+        }
+        if (fields.size() + size > Protocol::kMaxFrameSize) {
+            streamBlob(session, sender, fileName, blob);
+            return;
+        }
+        header = Protocol::encodeFrameHeader(Protocol::FrameType::FileRec, quint64(fields.size() + size)) + fields;
     } else {
-        log("Database connection SUCCESS! PostgreSQL is ready.");
+        header = "FILE_REC:" + sender.toUtf8() + ":" + fileName.toUtf8() + ":" + QByteArray::number(size) + ":";
     }
+    session->outbound().write(header);
+    session->outbound().writeFile(blob);
 }
 
-void Server::sendChatHistory(QTcpSocket *socket, const QString &myNick, const QString &friendNick) {
-    QSqlQuery query;
+// Больше одного кадра не влезает — тот же поток FileBegin/FileChunk/FileEnd, что и при пересылке на лету,
+// только с новым id. Куски читаются из mmap по мере того, как сокет освобождается
+void Server::streamBlob(Session *session, const QString &sender, const QString &fileName,
+                        const std::shared_ptr<const MappedBlob> &blob)
+{
+    const quint64 relayId = m_context->nextRelayId.fetch_add(1);
+    const qint64 size = blob->data().size();
+    OutboundQueue &outbound = session->outbound();
+
+    QByteArray payload;
+    Protocol::appendVarint(payload, relayId);
+    Protocol::appendField(payload, sender.toUtf8());
+    Protocol::appendField(payload, fileName.toUtf8());
+    Protocol::appendVarint(payload, quint64(size));
+    outbound.write(Protocol::encodeFrame(Protocol::FrameType::FileBegin, payload));
+
+    QByteArray id;
+    Protocol::appendVarint(id, relayId);
+    for (qint64 offset = 0; offset < size; offset += kBlobStreamChunkSize) {
+        const qint64 length = qMin(kBlobStreamChunkSize, size - offset);
+        outbound.write(Protocol::encodeFrameHeader(Protocol::FrameType::FileChunk, quint64(id.size() + length)) + id);
+        outbound.writeFile(blob, offset, length);
+    }
 
-    // Бронебойный запрос: достаем отправителя, текст(имя файла), время, флаг файла и сами байты
-    // Выбираем последние 50 сообщений
-    if (myNick == friendNick) {
-        query.prepare("SELECT sender, message, timestamp, is_file, file_data FROM messages "
-                      "WHERE sender = :me AND receiver = :me "
-                      "ORDER BY timestamp ASC LIMIT 50");
-    } else {
-        query.prepare("SELECT sender, message, timestamp, is_file, file_data FROM messages "
-                      "WHERE (sender = :me AND receiver = :friend) "
-                      "OR (sender = :friend AND receiver = :me) "
-                      "ORDER BY timestamp ASC LIMIT 50");
-        query.bindValue(":friend", friendNick);
-    }
-    query.bindValue(":me", myNick);
-
-    if (query.exec()) {
-        while (query.next()) {
-            QString sender = query.value(0).toString();
-            QString messageText = query.value(1).toString();
-            QString time = query.value(2).toDateTime().toString("hh:mm");
-            bool isFile = query.value(3).toBool();
-
-            if (isFile) {
-                // Если это файл — достаем байты из BYTEA
-                QByteArray fileBytes = query.value(4).toByteArray();
-
-                // Формируем наш стандартный пакет FILE_REC:от_кого:имя:размер:байты
-                QByteArray filePacket = "FILE_REC:" + sender.toUtf8() + ":" +
-                                        messageText.toUtf8() + ":" +
-                                        QByteArray::number(fileBytes.size()) + ":" +
-                                        fileBytes;
-
-                socket->write(filePacket);
-                // Небольшая задержка, чтобы TCP не склеил два файла в один поток (на всякий случай)
-                socket->waitForBytesWritten(100);
-            } else {
-                // Если это обычный текст — шлем по старому протоколу
-                QString line = QString("%1 %2: %3\n").arg(time, sender, messageText);
-                socket->write(line.toUtf8());
-            }
+    payload = id;
+    Protocol::appendVarint(payload, quint64(Protocol::FileStatus::Ok));
+    outbound.write(Protocol::encodeFrame(Protocol::FrameType::FileEnd, payload));
+}
+
+// Готовые кадры одним сжатым Compressed, если клиент договорился о сжатии и оно того стоит
+void Server::writeCompressed(Session *session, const QByteArray &frames)
+{
+    const Compression::Algorithm algorithm = session->compression();
+    if (algorithm != Compression::Algorithm::None && frames.size() >= m_context->config.compressionMinSize) {
+        const QByteArray compressed = Compression::compress(algorithm, frames);
+        if (!compressed.isEmpty()) {
+            QByteArray payload;
+            Protocol::appendVarint(payload, quint64(algorithm));
+            Protocol::appendVarint(payload, quint64(frames.size()));
+            payload.append(compressed);
+            session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::Compressed, payload));
+            m_context->metrics.compressionInput.add(frames.size());
+            m_context->metrics.compressionOutput.add(compressed.size());
+            return;
         }
-        log("History (with media) sent to " + myNick + " for chat with " + friendNick);
+    }
+    if (!frames.isEmpty()) session->outbound().write(frames);
+}
+
+// Само форматирование и запись — в потоке логгера
+void Server::log(const QString &message, LogLevel level)
+{
+    Logger::instance().write(level, QString(), QString(), message);
+}
+
+void Server::log(LogLevel level, const QString &event, const QString &user, const QString &message)
+{
+    Logger::instance().write(level, event, user, message);
+}
+
+// Ставит сообщение в очередь на запись. 0 — очередь полна, клиенту уже сказали
+// Для файла blobHash — уже взятая в хранилище ссылка; если не сохранили, она отпускается здесь же
+quint64 Server::persist(const QString &sender, const QString &receiver, const QString &message,
+                        Session *session, const QByteArray &blobHash, qint64 fileSize)
+{
+    const bool isFile = !blobHash.isEmpty();
+
+    MessageRecord record;
+    record.sender = sender;
+    record.receiver = receiver;
+    record.message = message;
+    record.isFile = isFile;
+    record.blobHash = blobHash;
+    record.fileSize = fileSize;
+    record.timestamp = QDateTime::currentDateTime();
+    record.ack = session->isBinary();
+
+    const quint64 id = m_context->writer->enqueue(std::move(record));
+    if (id == 0) {
+        if (Logger::enabled(LogLevel::Warning))
+            log(LogLevel::Warning, "write_queue_full", sender, "Message rejected, write queue is full");
+        sendText(session, "SYSTEM: Server is busy, message not sent. Try again.");
+        if (isFile) m_context->blobs.release(blobHash);
+        return 0;
+    }
+    return id;
+}
+
+void Server::sendChatHistory(Session *session, const QString &myNick, const QString &friendNick,
+                             quint64 beforeId, int limit, bool withCursor) {
+    m_context->metrics.historyRequests.add();
+    const QString key = HistoryCache::conversationKey(myNick, friendNick);
+    QList<HistoryEntry> entries;
+
+    // Свежая страница — сначала из памяти, в БД только при промахе
+    const bool recentPage = beforeId == 0 && limit <= kHistoryPageSize;
+    if (recentPage && m_context->history.recent(key, entries)) {
+        if (entries.size() > limit) entries = entries.sliced(entries.size() - limit);
     } else {
-        log("SQL History Error: " + query.lastError().text(), LogLevel::Error);
+        const int pageSize = recentPage ? kHistoryPageSize : limit;
+        const quint64 ticket = recentPage ? m_context->history.beginFill() : 0;
+        if (!loadHistoryPage(myNick, friendNick, beforeId, pageSize, entries)) {
+            if (recentPage) m_context->history.cancelFill(ticket);
+            return;
+        }
+        if (recentPage) {
+            m_context->history.fill(key, entries, ticket);
+            if (entries.size() > limit) entries = entries.sliced(entries.size() - limit);
+        }
+    }
+
+    const bool binary = session->isBinary();
+    // Страница целиком одним сжатым кадром: десятки коротких строк по отдельности почти не ужимаются
+    const bool packPage = binary && session->compression() != Compression::Algorithm::None;
+    if (packPage) session->outbound().beginCapture();
+
+    for (const HistoryEntry &entry : std::as_const(entries)) {
+        if (entry.isFile && !entry.blobHash.isEmpty()) {
+            // Бинарному клиенту — только ссылка, сам файл он попросит через BlobGet, если понадобится
+            if (binary)
+                session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::FileRef,
+                    fileRefPayload(entry.id, entry.sender, entry.message, entry.fileSize, entry.blobHash)));
+            else
+                sendBlob(session, entry.sender, entry.message, entry.blobHash, entry.fileSize);
+        } else if (entry.isFile) {
+            // Старый файл, лежит прямо в БД — тело только сейчас и только одного.
+            // В FILE_REC есть размер, так что файлы подряд клиент разберет и без пауз
+            sendFile(session, entry.sender, entry.message, m_context->store->legacyFileBody(entry.id));
+        } else {
+            sendText(session, QString("%1 %2: %3").arg(entry.timestamp.toString("hh:mm"), entry.sender, entry.message));
+        }
     }
+
+    // Курсор для следующей (более старой) страницы; 0 — дальше ничего нет
+    if (withCursor) {
+        const quint64 cursor = entries.size() < limit ? 0 : entries.first().id;
+        sendText(session, QString("HISTORY_CURSOR:%1:%2").arg(friendNick).arg(cursor));
+    }
+    if (packPage) writeCompressed(session, session->outbound().takeCapture());
+    if (Logger::enabled(LogLevel::Debug))
+        log(LogLevel::Debug, "history", myNick, "History sent for chat with " + friendNick);
 }
 
-void Server::handleFileTransfer(QTcpSocket *socket, const QByteArray &data)
+// Страница истории (от старых к новым) с id < beforeId; beforeId = 0 — самые свежие
+bool Server::loadHistoryPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                             QList<HistoryEntry> &entries)
 {
-    QByteArray fullData = data;
+    ScopedTimer timer(m_context->metrics.historyQueryLatency);
+    return m_context->store->loadPage(myNick, friendNick, beforeId, limit, entries);
+}
 
-    // 1. Быстро парсим заголовок, чтобы узнать, сколько байт МЫ ЖДЕМ
-    QList<QByteArray> parts = fullData.split(':');
-    if (parts.size() < 4) return;
+// Старый протокол: FILE:получатель:имя:размер:байты...
+// Заголовок приходит первым чтением, тело дальше потоком в spool
+void Server::handleFileTransfer(Session *session, QByteArrayView data)
+{
+    if (!session->isRegistered()) return;
+
+    // 1. Ищем конец заголовка — четвертое двоеточие
+    qsizetype headerSize = -1;
+    int colons = 0;
+    for (qsizetype i = 0; i < data.size(); ++i) {
+        if (data[i] == ':' && ++colons == 4) {
+            headerSize = i + 1;
+            break;
+        }
+    }
+    if (headerSize < 0) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Malformed FILE header", LogLevel::Warning);
+        return;
+    }
 
-    int expectedSize = parts[3].toInt(); // Тот размер, который прислал клиент
+    QList<QByteArray> parts = data.first(headerSize - 1).toByteArray().split(':');
+    bool sizeOk = false;
+    qint64 expectedSize = parts[3].toLongLong(&sizeOk); // Тот размер, который прислал клиент
     QString fileName = QString::fromUtf8(parts[2]);
     QString target = QString::fromUtf8(parts[1]);
 
-    // 2. ДОЧИТЫВАЕМ ИЗ СОКЕТА, пока не наберем нужный вес
-    // Мы даем серверу немного подождать (блокирующее чтение для простоты)
-    while (fullData.size() < (expectedSize + 50)) { // +50 на заголовок
-        if (socket->waitForReadyRead(500)) { // Ждем данные полсекунды
-            fullData.append(socket->readAll());
+    if (!sizeOk || expectedSize < 0 || expectedSize > kMaxFileSize) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Rejected file with bad size: " + QString::fromUtf8(parts[3]), LogLevel::Warning);
+        sendText(session, "SYSTEM: File rejected.");
+        // Тело файла уже летит следом, в текстовом потоке его не отделить
+        closeSession(session);
+        return;
+    }
+
+    // 2. Всё, что пришло после заголовка, — уже тело файла, остальное допишет handleLegacyData
+    FileUpload *upload = startUpload(session, kLegacyTransferId, target, fileName, expectedSize, false);
+    if (upload)
+        feedUpload(session, upload, data.sliced(headerSize));
+}
+
+void Server::handleFileBegin(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 transferId = 0, size = 0;
+    QByteArrayView target, fileName;
+    if (!reader.readVarint(transferId) || !reader.readField(target) ||
+        !reader.readField(fileName) || !reader.readVarint(size) || transferId == 0) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Malformed FILE_BEGIN frame", LogLevel::Warning);
+        return;
+    }
+
+    QByteArray ack;
+    Protocol::appendVarint(ack, transferId);
+
+    if (size > quint64(kMaxFileSize)) {
+        if (Logger::enabled(LogLevel::Warning))
+            log(QString("Rejected file %1: %2 bytes").arg(QString::fromUtf8(fileName)).arg(size), LogLevel::Warning);
+        Protocol::appendVarint(ack, quint64(Protocol::FileStatus::Failed));
+        session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::FileEnd, ack));
+        return;
+    }
+
+    FileUpload *upload = startUpload(session, transferId, QString::fromUtf8(target),
+                                     QString::fromUtf8(fileName), qint64(size), true);
+    if (!upload) {
+        Protocol::appendVarint(ack, quint64(Protocol::FileStatus::Failed));
+        session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::FileEnd, ack));
+        return;
+    }
+
+    // Говорим клиенту, с какого места слать (докачка после обрыва)
+    Protocol::appendVarint(ack, quint64(upload->received()));
+    session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::FileAck, ack));
+
+    // Пустой или уже докачанный файл завершится сразу
+    feedUpload(session, upload, {});
+}
+
+void Server::handleFileChunk(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 transferId = 0;
+    if (!reader.readVarint(transferId)) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Malformed FILE_CHUNK frame", LogLevel::Warning);
+        return;
+    }
+
+    FileUpload *upload = session->uploads().value(transferId);
+    if (!upload) {
+        if (Logger::enabled(LogLevel::Warning))
+            log(QString("Chunk for unknown transfer %1 ignored").arg(transferId), LogLevel::Warning);
+        return;
+    }
+    feedUpload(session, upload, reader.rest());
+}
+
+void Server::handleFileEnd(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 transferId = 0;
+    if (!reader.readVarint(transferId)) return;
+
+    // Клиент сам отменил загрузку
+    if (FileUpload *upload = session->uploads().value(transferId)) {
+        if (Logger::enabled(LogLevel::Info))
+            log("Upload cancelled: " + upload->fileName() + " from " + upload->sender());
+        abortUpload(session, upload, false);
+    }
+}
+
+FileUpload *Server::startUpload(Session *session, quint64 transferId, const QString &target,
+                                const QString &fileName, qint64 size, bool resume)
+{
+    if (session->uploads().contains(transferId)) {
+        sendText(session, "SYSTEM: Upload already in progress.");
+        return nullptr;
+    }
+
+    auto *upload = new FileUpload(transferId, session->nick(), target, fileName, size);
+    switch (upload->open(m_context->spoolDir, resume)) {
+    case FileUpload::OpenStatus::Ok:
+        break;
+
+    case FileUpload::OpenStatus::Busy:
+        if (Logger::enabled(LogLevel::Warning))
+            log(LogLevel::Warning, "upload_busy", upload->sender(), "Same upload already in progress: " + fileName);
+        delete upload;
+        sendText(session, "SYSTEM: This file is already being uploaded.");
+        return nullptr;
+
+    case FileUpload::OpenStatus::Error:
+        log("Cannot open spool file " + upload->spoolPath(), LogLevel::Error);
+        delete upload;
+        sendText(session, "SYSTEM: Upload failed.");
+        return nullptr;
+    }
+
+    session->uploads().insert(transferId, upload);
+    beginRelays(upload);
+
+    if (Logger::enabled(LogLevel::Info))
+        log(LogLevel::Info, "upload_start", upload->sender(), QString("Upload started: %1 (%2 bytes, resumed at %3) to %4")
+                .arg(fileName).arg(size).arg(upload->resumedFrom()).arg(target));
+    return upload;
+}
+
+// Пишем кусок в spool и сразу отдаем живым получателям
+qint64 Server::feedUpload(Session *session, FileUpload *upload, QByteArrayView chunk)
+{
+    const qint64 taken = upload->append(chunk);
+    if (taken < 0) {
+        log("Spool write failed for " + upload->fileName(), LogLevel::Error);
+        abortUpload(session, upload, false);
+        return -1;
+    }
+
+    if (taken > 0) {
+        m_context->metrics.fileBytesUploaded.add(taken);
+        relayChunk(upload, chunk.first(taken));
+    }
+
+    if (upload->isComplete())
+        finishUpload(session, upload);
+    return taken;
+}
+
+void Server::finishUpload(Session *session, FileUpload *upload)
+{
+    upload->close();
+
+    // Spool-файл целиком переезжает в хранилище, в БД идет только ссылка на него
+    const QByteArray hash = upload->contentHash();
+    quint64 id = 0;
+    if (m_context->blobs.adopt(upload->spoolPath(), hash))
+        id = persist(upload->sender(), upload->target(), upload->fileName(), session, hash, upload->size());
+    else
+        log("Cannot move " + upload->spoolPath() + " to blob store", LogLevel::Error);
+
+    const bool saved = id != 0;
+    if (saved) {
+        m_context->metrics.filesStored.add();
+        if (Logger::enabled(LogLevel::Info))
+            log(LogLevel::Info, "upload_done", upload->sender(), QString("File %1 (%2 bytes, %3) queued")
+                    .arg(upload->fileName()).arg(upload->size()).arg(QString::fromLatin1(hash)));
+    }
+
+    const QByteArray ref = saved ? fileRefPayload(id, upload->sender(), upload->fileName(), upload->size(), hash)
+                                 : QByteArray();
+
+    for (const FileUpload::Relay &relay : upload->relays()) {
+        if (relay.live)
+            endRelay(relay.nick, relay.relayId, saved ? Protocol::FileStatus::Ok : Protocol::FileStatus::Failed, ref);
+        else if (saved)
+            deliver(relay.nick, Protocol::FrameType::FileRef, ref);
+    }
+
+    upload->discard();
+    removeUpload(session, upload);
+}
+
+void Server::abortUpload(Session *session, FileUpload *upload, bool keepSpool)
+{
+    for (const FileUpload::Relay &relay : upload->relays()) {
+        if (relay.live)
+            endRelay(relay.nick, relay.relayId, Protocol::FileStatus::Aborted);
+    }
+
+    // Бинарный клиент может докачать позже — оставляем .part
+    if (keepSpool)
+        upload->close();
+    else
+        upload->discard();
+    removeUpload(session, upload);
+}
+
+void Server::removeUpload(Session *session, FileUpload *upload)
+{
+    session->uploads().remove(upload->transferId());
+    delete upload;
+}
+
+void Server::beginRelays(FileUpload *upload)
+{
+    QStringList recipients{upload->target()};
+    if (upload->sender() != upload->target()) recipients << upload->sender();
+
+    for (const QString &nick : recipients) {
+        UserDirectory::Entry entry;
+        if (!m_context->directory.lookup(nick, entry)) continue;
+
+        FileUpload::Relay relay;
+        relay.nick = nick;
+        relay.live = entry.binary;
+        relay.compression = entry.compression;
+
+        if (relay.live) {
+            // id уникален на весь сервер: получатель может собирать файлы с разных шардов
+            relay.relayId = m_context->nextRelayId.fetch_add(1);
+
+            QByteArray payload;
+            Protocol::appendVarint(payload, relay.relayId);
+            Protocol::appendField(payload, upload->sender().toUtf8());
+            Protocol::appendField(payload, upload->fileName().toUtf8());
+            Protocol::appendVarint(payload, quint64(upload->size()));
+            deliver(nick, Protocol::FrameType::FileBegin, payload);
+        }
+        upload->relays().append(relay);
+    }
+
+    // Докачка: сначала то, что уже лежит в спуле с прошлой попытки
+    for (qint64 offset = 0; offset < upload->received(); offset += kFileChunkSize)
+        relayChunk(upload, upload->readSpool(offset, kFileChunkSize));
+}
+
+// Кусок всем живым получателям. Сжимаем не больше раза на алгоритм, сколько бы их ни было
+void Server::relayChunk(FileUpload *upload, QByteArrayView chunk)
+{
+    QHash<Compression::Algorithm, QByteArray> packed;
+    for (const FileUpload::Relay &relay : upload->relays()) {
+        if (!relay.live) continue;
+
+        QByteArray payload;
+        Protocol::appendVarint(payload, relay.relayId);
+
+        const bool compress = relay.compression != Compression::Algorithm::None && upload->isCompressible()
+                              && chunk.size() >= m_context->config.compressionMinSize;
+        if (compress && !packed.contains(relay.compression)) {
+            packed.insert(relay.compression, Compression::compress(relay.compression, chunk));
+            // Не ужался — скорее всего, и дальше не будет
+            if (packed.value(relay.compression).isEmpty()) upload->setCompressible(false);
+        }
+
+        const QByteArray compressed = compress ? packed.value(relay.compression) : QByteArray();
+        Protocol::FrameType type = Protocol::FrameType::FileChunk;
+        if (compressed.isEmpty()) {
+            payload.append(chunk);
         } else {
-            break; // Тайм-аут
+            type = Protocol::FrameType::CompressedFileChunk;
+            Protocol::appendVarint(payload, quint64(relay.compression));
+            Protocol::appendVarint(payload, quint64(chunk.size()));
+            payload.append(compressed);
+            m_context->metrics.compressionInput.add(chunk.size());
+            m_context->metrics.compressionOutput.add(compressed.size());
+        }
+        if (deliver(relay.nick, type, payload))
+            m_context->metrics.fileBytesRelayed.add(chunk.size());
+    }
+}
+
+// ref — ссылка на сохраненный файл: по ней шард получателя отдаст файл тем, кому пересылку отложили
+void Server::endRelay(const QString &nick, quint64 relayId, Protocol::FileStatus status, const QByteArray &ref)
+{
+    QByteArray payload;
+    Protocol::appendVarint(payload, relayId);
+    Protocol::appendVarint(payload, quint64(status));
+    payload.append(ref);
+    deliver(nick, Protocol::FrameType::FileEnd, payload);
+}
+
+void Server::sweepUploads()
+{
+    QList<QPair<Session*, FileUpload*>> stalled;
+    for (Session *session : std::as_const(m_sessions)) {
+        for (FileUpload *upload : std::as_const(session->uploads())) {
+            if (upload->isStalled()) stalled.append({session, upload});
         }
     }
 
-    // 3. Теперь, когда у нас (надеюсь) всё в сборе, вырезаем байты
-    int headerSize = 5 + parts[1].size() + 1 + parts[2].size() + 1 + parts[3].size() + 1;
-    QByteArray fileBytes = fullData.mid(headerSize, expectedSize);
+    for (const auto &[session, upload] : stalled) {
+        if (Logger::enabled(LogLevel::Warning))
+            log(LogLevel::Warning, "upload_stalled", upload->sender(), QString("Upload stalled: %1 (%2/%3 bytes)")
+                    .arg(upload->fileName()).arg(upload->received()).arg(upload->size()));
 
-    QString senderName = m_clients.key(socket);
+        const bool binary = session->isBinary();
+        abortUpload(session, upload, binary);
+        // Старый протокол: хвост файла потом прилетит как "текст" — проще закрыть соединение
+        if (!binary) closeSession(session);
+    }
+}
 
-    // 4. СОХРАНЯЕМ В БД (только если реально долетело много байт)
-    QSqlQuery query;
-    query.prepare("INSERT INTO messages (sender, receiver, message, file_data, is_file) VALUES (:s, :r, :m, :d, TRUE)");
-    query.bindValue(":s", senderName);
-    query.bindValue(":r", target);
-    query.bindValue(":m", fileName);
-    query.bindValue(":d", fileBytes);
+void Server::storeAndRelayFile(Session *session, const QString &target, const QString &fileName, const QByteArray &fileBytes)
+{
+    QString senderName = session->nick();
 
-    if (query.exec()) {
-        log(QString("SUCCESS: File %1 (%2 bytes) saved from %3").arg(fileName).arg(fileBytes.size()).arg(senderName));
+    // 4. СКЛАДЫВАЕМ В ХРАНИЛИЩЕ, В БД — ТОЛЬКО ССЫЛКУ
+    const QByteArray hash = m_context->blobs.store(fileBytes);
+    if (hash.isEmpty()) {
+        log("Cannot store file " + fileName + " from " + senderName, LogLevel::Error);
+        sendText(session, "SYSTEM: Upload failed.");
+        return;
+    }
 
-        // 5. РАССЫЛКА КЛИЕНТАМ (уже с новым заголовком FILE_REC)
-        QByteArray relayPacket = "FILE_REC:" + senderName.toUtf8() + ":" + fileName.toUtf8() + ":" +
-                                 QByteArray::number(fileBytes.size()) + ":" + fileBytes;
+    const quint64 id = persist(senderName, target, fileName, session, hash, fileBytes.size());
+    if (id) {
+        m_context->metrics.filesStored.add();
+        if (Logger::enabled(LogLevel::Info))
+            log(QString("SUCCESS: File %1 (%2 bytes) queued from %3").arg(fileName).arg(fileBytes.size()).arg(senderName));
 
-        if (m_clients.contains(target)) m_clients[target]->write(relayPacket);
-        socket->write(relayPacket);
+        // 5. РАССЫЛКА КЛИЕНТАМ: получатель читает файл с диска у себя на шарде
+        if (target != senderName)
+            deliver(target, Protocol::FrameType::FileRef, fileRefPayload(id, senderName, fileName, fileBytes.size(), hash));
+        sendBlob(session, senderName, fileName, hash, fileBytes.size());
     }
 }
 
-void Server::handleTextMessage(QTcpSocket *socket, const QString &data)
+// Договариваемся о сжатии — только до ника, потом поздно: каталог уже знает, как слать этому клиенту
+void Server::handleHello(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 clientMask = 0;
+    if (session->isRegistered() || !reader.readVarint(clientMask)) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Unexpected HELLO frame", LogLevel::Warning);
+        return;
+    }
+
+    const Compression::Algorithm algorithm =
+        Compression::negotiate(quint32(clientMask), m_context->config.compressionAlgorithms);
+    session->setCompression(algorithm);
+
+    QByteArray payload;
+    Protocol::appendVarint(payload, quint64(algorithm));
+    session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::Hello, payload));
+    if (Logger::enabled(LogLevel::Debug))
+        log(LogLevel::Debug, "hello", QString(), "Compression negotiated: " + Compression::name(algorithm));
+}
+
+// Пинг от клиента: отвечаем той же меткой
+void Server::handlePing(Session *session, const Protocol::Frame &frame)
+{
+    session->outbound().write(Protocol::encodeFrame(Protocol::FrameType::Pong, frame.payload));
+}
+
+void Server::handlePong(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 sentAt = 0;
+    if (!reader.readVarint(sentAt) || session->pingSentAt() < 0) {
+        if (Logger::enabled(LogLevel::Debug)) log("Unexpected PONG frame", LogLevel::Debug);
+        return;
+    }
+
+    session->setPingSentAt(-1);
+    m_context->metrics.pongsReceived.add();
+    const qint64 rtt = monotonicNanos() - qint64(sentAt);
+    if (rtt >= 0) m_context->metrics.pingRtt.record(rtt);
+}
+
+// Клиент просит файл по ссылке из истории. Отдаем только участникам переписки
+void Server::handleBlobGet(Session *session, const Protocol::Frame &frame)
+{
+    Protocol::PayloadReader reader(frame.payload);
+    quint64 messageId = 0;
+    if (!reader.readVarint(messageId)) {
+        if (Logger::enabled(LogLevel::Warning))
+            log("Malformed BLOB_GET frame", LogLevel::Warning);
+        return;
+    }
+
+    StoredFile file;
+    const QString myNick = session->nick();
+    if (!m_context->store->findFile(messageId, file) || (file.sender != myNick && file.receiver != myNick)) {
+        sendText(session, "SYSTEM: File not found.");
+        return;
+    }
+
+    sendBlob(session, file.sender, file.name, file.blobHash, file.size);
+}
+
+void Server::handleTextMessage(Session *session, const QString &data)
 {
     if (data.isEmpty()) return;
 
     // 1.1. РЕГИСТРАЦИЯ (Если юзер еще не в системе)
-    if (!m_clients.values().contains(socket)) {
-        if (isValidName(data)) {
-            m_clients[data] = socket;
+    if (!session->isRegistered()) {
+        if (!isValidName(data)) {
+            if (Logger::enabled(LogLevel::Warning))
+                log(LogLevel::Warning, "register_rejected", data, "Invalid nickname");
+            sendText(session, "SYSTEM: Invalid nickname!");
+            closeSession(session);
+        } else if (!m_context->directory.insert(data, UserDirectory::Entry{this, session, session->isBinary(), session->compression()})) {
+            // Ник уже занят (возможно, на другом шарде)
+            if (Logger::enabled(LogLevel::Warning))
+                log(LogLevel::Warning, "register_rejected", data, "Nickname already taken");
+            sendText(session, "SYSTEM: Nickname is already taken!");
+            closeSession(session);
+        } else {
+            session->setRegistered(data);
+            m_byNick.insert(data, session);
 
-            // СНАЧАЛА добавили в QMap, ПОТОМ рассылаем всем
-            sendToAll("SYSTEM: Пользователь [" + data + "] вошел в чат");
-            broadcastUserList(); // Тот самый метод, который оживит твой список справа
+            // СНАЧАЛА добавили в каталог, ПОТОМ рассылаем всем. Строку "вошел в чат" старым
+            // клиентам добавит та же пачка присутствия
+            sendUserList(session); // полный список — только новичку
+            broadcastPresence("+" + data); // остальным — только изменение
+            armSessionTimer(session); // вместо срока регистрации — пульс и простой
 
-            log("User registered: " + data);
-        } else {
-            log("Rejected nick: " + data, LogLevel::Warning);
-            socket->write("SYSTEM: Invalid nickname!\n");
-            socket->disconnectFromHost();
+            if (Logger::enabled(LogLevel::Info))
+                log(LogLevel::Info, "register", data, "User registered");
         }
         return; // ОБЯЗАТЕЛЬНО выходим
     }
@@ -249,14 +1287,52 @@ void Server::handleTextMessage(QTcpSocket *socket, const QString &data)
 
     // 1.2. КОМАНДЫ (Уже для зарегистрированных)
     if (data.startsWith("/get_history ")) {
-        QString friendNick = data.mid(13).trimmed();
-        QString myNick = m_clients.key(socket);
-        sendChatHistory(socket, myNick, friendNick);
+        // /get_history ник [before=<id>] [limit=<n>] — параметры в конце, в нике бывают пробелы
+        QStringList args = data.mid(13).split(' ', Qt::SkipEmptyParts);
+        quint64 beforeId = 0;
+        int limit = kHistoryPageSize;
+        bool paged = false;
+        while (args.size() > 1) {
+            if (args.last().startsWith("before=")) beforeId = args.takeLast().mid(7).toULongLong();
+            else if (args.last().startsWith("limit=")) limit = qBound(1, args.takeLast().mid(6).toInt(), kMaxHistoryPage);
+            else break;
+            paged = true;
+        }
+        QString friendNick = args.join(' ');
+        QString myNick = session->nick();
+        // Старым клиентам курсор шлем, только если они сами просили страницу
+        sendChatHistory(session, myNick, friendNick, beforeId, limit, paged || session->isBinary());
+        return;
+    }
+
+    if (data == "/cache_stats") {
+        sendText(session, QString("SERVER: history cache %1 hits, %2 misses, %3 conversations")
+                              .arg(m_context->history.hits()).arg(m_context->history.misses())
+                              .arg(m_context->history.conversations()));
+        return;
+    }
+
+    if (data == "/queue_stats") {
+        const OutboundQueue::Stats stats = session->outbound().stats();
+        sendText(session, QString("SERVER: outbound queue %1 bytes (peak %2), slow %3 times, "
+                                  "%4 presence updates dropped, %5 files deferred")
+                              .arg(stats.queuedBytes).arg(stats.peakBytes).arg(stats.congestions)
+                              .arg(stats.droppedPresence).arg(stats.deferredFiles));
+        return;
+    }
+
+    if (data == "/stats") {
+        if (!m_context->config.adminNicks.contains(session->nick())) {
+            sendText(session, "SYSTEM: Not allowed.");
+            return;
+        }
+        for (const QString &line : StatsServer::summary(*m_context))
+            sendText(session, line);
         return;
     }
 
     if (data == "/uptime") {
-        socket->write(QString("SERVER: My uptime is %1\n").arg(getUptime()).toUtf8());
+        sendText(session, QString("SERVER: My uptime is %1").arg(getUptime()));
         return;
     }
 
@@ -264,33 +1340,29 @@ void Server::handleTextMessage(QTcpSocket *socket, const QString &data)
     if (data.contains(":")) {
         QString target = data.section(':', 0, 0);
         QString text = data.section(':', 1);
-        QString senderName = m_clients.key(socket);
+        QString senderName = session->nick();
 
         if (target.length() > 20  || target.contains(" "))
             return;
 
-        if (m_clients.contains(target))
+        UserDirectory::Entry entry;
+        if (m_context->directory.lookup(target, entry))
         {
+            // Запись в БД (is_file = FALSE) — в фоне, пачкой; если очередь полна, не доставляем
+            if (!persist(senderName, target, text, session))
+                return;
+
             QString time = QDateTime::currentDateTime().toString("hh:mm");
-            QString packet = QString("%1 %2: %3\n").arg(time, senderName, text);
+            QString packet = QString("%1 %2: %3").arg(time, senderName, text);
 
-            m_clients[target]->write(packet.toUtf8());
+            deliver(target, Protocol::FrameType::Text, packet.toUtf8());
             if (target != senderName) {
-                socket->write(packet.toUtf8());
+                sendText(session, packet);
             }
-
-            // Запись в БД (is_file = FALSE)
-            QSqlQuery query;
-            query.prepare("INSERT INTO messages (sender, receiver, message, is_file) "
-                          "VALUES (:s, :r, :m, FALSE)");
-            query.bindValue(":s", senderName);
-            query.bindValue(":r", target);
-            query.bindValue(":m", text);
-            query.exec();
         }
         else
         {
-            socket->write("SYSTEM: User not found.\n");
+            sendText(session, "SYSTEM: User not found.");
         }
 
     }
@@ -4,44 +4,132 @@
 #include <QObject>
 #include <QTcpServer>
 #include <QTcpSocket>
-#include <QMap>
+#include <QHash>
 #include <QDateTime>
-#include <QSqlQuery>
-#include <QSqlError>
-#include <QSqlDatabase>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <atomic>
+#include "protocol.h"
+#include "filetransfer.h"
+#include "mailbox.h"
+#include "session.h"
+#include "historycache.h"
+#include "logger.h"
+#include "timerwheel.h"
 
+struct ServerContext;
+
+// Сообщение для клиента, который может жить на другом шарде
+struct Envelope {
+    QString target; // пусто — всем клиентам шарда
+    Protocol::FrameType type = Protocol::FrameType::Text;
+    QByteArray payload;
+};
+
+// Один шард: свой поток, свой event loop, своя часть соединений
 class Server : public QObject {
     Q_OBJECT
 public:
-    explicit Server(QObject *parent = nullptr);
+    Server(int shardId, ServerContext *context, QObject *parent = nullptr);
+
+    using LogLevel = ::LogLevel;
+
+    static void log(const QString &message,LogLevel level = LogLevel::Info);
+    // С полями для разбора лога: событие и пользователь
+    static void log(LogLevel level, const QString &event, const QString &user, const QString &message);
+
+    // Вызывается из потока шарда (Listener ставит это в очередь)
+    void addConnection(qintptr socketDescriptor);
 
-    enum class LogLevel{
-        Info,
-        Warning,
-        Error
-    };
+    // Потокобезопасно: можно звать с любого шарда
+    void post(Envelope envelope);
+
+public slots:
+    void start();
+    // Из QThread::finished, еще в потоке шарда: закрыть клиентов без рассылок и остановить таймеры
+    void shutdown();
 
 private slots:
-    void onNewConnection();
+    void drainMailbox();
     void onReadyRead();
     void onDisconnected();
+    void onBytesWritten();
+    void sweepUploads();
+    void flushPresence();
+    void tickTimers();
 
 private:
-    QTcpServer *m_server;
-    QMap<QString, QTcpSocket*> m_clients;
-    QDateTime m_startTime;
-    QSqlDatabase m_db;
+    int m_shardId;
+    ServerContext *m_context;
+    Mailbox<Envelope> m_mailbox;
+    std::atomic<bool> m_drainScheduled{false};
+    bool m_shuttingDown = false;
+
+    // Только клиенты этого шарда, в обе стороны за O(1); кто где — в m_context->directory
+    QHash<QTcpSocket*, Session*> m_sessions;
+    QHash<QString, Session*> m_byNick;
+    QTimer *m_uploadSweepTimer;
+
+    // Накопленные изменения присутствия: ник -> '+' или '-'
+    QHash<QString, QChar> m_presenceDeltas;
+    bool m_presenceChanged = false;
+    QTimer *m_presenceTimer;
 
-    void broadcastUserList();
+    // Сроки всех сессий шарда на одном колесе; его время — от m_clock
+    TimerWheel m_timers;
+    QElapsedTimer m_clock;
+    QTimer *m_tickTimer;
+
+    void broadcastPresence(const QString &delta);
+    void queuePresence(const QString &delta);
+    void sendUserList(Session *session);
+    void closeSession(Session *session);
+    void armSessionTimer(Session *session);
+    void onSessionTimer(Session *session);
+    void evict(Session *session, Counter &counter, const QString &reason, const QString &message);
     QString getUptime() const;
     bool isValidName(const QString &name);
-    void sendToAll(const QString &message);
-    void log(const QString &message,LogLevel level = LogLevel::Info);
-    void initDb();
-    void sendChatHistory(QTcpSocket *socket,const QString &myNick,const QString &friendNick);
+    bool deliver(const QString &nick, Protocol::FrameType type, const QByteArray &payload);
+    void deliverLocal(const Envelope &envelope);
+    void deliverRelay(Session *session, const Envelope &envelope);
+    quint64 persist(const QString &sender, const QString &receiver, const QString &message,
+                    Session *session, const QByteArray &blobHash = QByteArray(), qint64 fileSize = 0);
+    void sendChatHistory(Session *session,const QString &myNick,const QString &friendNick,
+                         quint64 beforeId, int limit, bool withCursor);
+    bool loadHistoryPage(const QString &myNick, const QString &friendNick, quint64 beforeId, int limit,
+                         QList<HistoryEntry> &entries);
+
+    void handleLegacyData(Session *session, const QByteArray &rawData);
+    void handleFrame(Session *session, const Protocol::Frame &frame);
+    void handleFileTransfer(Session *session, QByteArrayView data);
+    void handleFileBegin(Session *session, const Protocol::Frame &frame);
+    void handleFileChunk(Session *session, const Protocol::Frame &frame);
+    void handleFileEnd(Session *session, const Protocol::Frame &frame);
+    void handleBlobGet(Session *session, const Protocol::Frame &frame);
+    void handleHello(Session *session, const Protocol::Frame &frame);
+    void handlePing(Session *session, const Protocol::Frame &frame);
+    void handlePong(Session *session, const Protocol::Frame &frame);
+    void handleTextMessage(Session *session, const QString &data);
+    void storeAndRelayFile(Session *session, const QString &target, const QString &fileName, const QByteArray &fileBytes);
+
+    FileUpload *startUpload(Session *session, quint64 transferId, const QString &target,
+                            const QString &fileName, qint64 size, bool resume);
+    qint64 feedUpload(Session *session, FileUpload *upload, QByteArrayView chunk);
+    void finishUpload(Session *session, FileUpload *upload);
+    void abortUpload(Session *session, FileUpload *upload, bool keepSpool);
+    void removeUpload(Session *session, FileUpload *upload);
+    void beginRelays(FileUpload *upload);
+    void relayChunk(FileUpload *upload, QByteArrayView chunk);
+    void endRelay(const QString &nick, quint64 relayId, Protocol::FileStatus status,
+                  const QByteArray &ref = QByteArray());
 
-    void handleFileTransfer(QTcpSocket *socket, const QByteArray &data);
-    void handleTextMessage(QTcpSocket *socket, const QString &data);
+    void sendText(Session *session, const QString &text);
+    void sendFile(Session *session, const QString &sender, const QString &fileName, const QByteArray &fileBytes);
+    void sendBlob(Session *session, const QString &sender, const QString &fileName,
+                  const QByteArray &hash, qint64 size);
+    void streamBlob(Session *session, const QString &sender, const QString &fileName,
+                    const std::shared_ptr<const MappedBlob> &blob);
+    void writeCompressed(Session *session, const QByteArray &frames);
 };
 
 #endif
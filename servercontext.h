@@ -0,0 +1,34 @@
+#ifndef SERVERCONTEXT_H
+#define SERVERCONTEXT_H
+
+#include <QDateTime>
+#include <QList>
+#include <QString>
+#include <atomic>
+#include "blobstore.h"
+#include "config.h"
+#include "historycache.h"
+#include "metrics.h"
+#include "userdirectory.h"
+
+class Server;
+class MessageWriter;
+class MessageStore;
+
+// Общее состояние всех шардов. Создается в main до старта потоков,
+// после старта меняются только каталог и счетчики.
+struct ServerContext {
+    ServerConfig config;
+    QDateTime startTime;
+    QString spoolDir;
+    BlobStore blobs;
+    UserDirectory directory;
+    HistoryCache history;
+    Metrics metrics;
+    QList<Server*> shards;
+    MessageStore *store = nullptr;
+    MessageWriter *writer = nullptr;
+    std::atomic<quint64> nextRelayId{1};
+};
+
+#endif
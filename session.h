@@ -0,0 +1,88 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QTcpSocket>
+#include "compression.h"
+#include "config.h"
+#include "filetransfer.h"
+#include "outboundqueue.h"
+#include "protocol.h"
+#include "timerwheel.h"
+
+// Всё, что шард знает об одном соединении. Создается при подключении,
+// удаляется вместе с сокетом.
+class Session {
+public:
+    enum class State {
+        Connected,  // ждем ник
+        Registered,
+        Closing
+    };
+
+    Session(QTcpSocket *socket, const ServerConfig &config, Metrics *metrics)
+        : m_socket(socket), m_outbound(socket, config, metrics), m_timer(this) {}
+    ~Session() { qDeleteAll(m_uploads); }
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    QTcpSocket *socket() const { return m_socket; }
+    const QString &nick() const { return m_nick; }
+    State state() const { return m_state; }
+    bool isRegistered() const { return m_state == State::Registered; }
+    bool isBinary() const { return m_decoder.mode() == Protocol::FrameDecoder::Mode::Binary; }
+
+    void setRegistered(const QString &nick)
+    {
+        m_nick = nick;
+        m_state = State::Registered;
+    }
+    void setClosing() { m_state = State::Closing; }
+
+    Protocol::FrameDecoder &decoder() { return m_decoder; }
+
+    // О чем договорились в Hello; None — клиент сжатие не просил
+    Compression::Algorithm compression() const { return m_compression; }
+    void setCompression(Compression::Algorithm algorithm) { m_compression = algorithm; }
+
+    // Всё, что пишем клиенту, — только через очередь, иначе влезем в середину файла
+    OutboundQueue &outbound() { return m_outbound; }
+
+    // Загрузки по id передачи (у старого протокола одна загрузка с id 0)
+    QHash<quint64, FileUpload*> &uploads() { return m_uploads; }
+
+    // Срок регистрации, потом проверки пульса и простоя — один таймер на колесе шарда
+    TimerWheel::Timer &timer() { return m_timer; }
+    // Когда клиент последний раз что-то прислал и когда ему ушел Ping без ответа (-1 — не ждем); время колеса
+    qint64 lastActivity() const { return m_lastActivity; }
+    void setLastActivity(qint64 ms) { m_lastActivity = ms; }
+    qint64 pingSentAt() const { return m_pingSentAt; }
+    void setPingSentAt(qint64 ms) { m_pingSentAt = ms; }
+    // Когда сокет последний раз освобождался (bytesWritten)
+    qint64 lastDrain() const { return m_lastDrain; }
+    void setLastDrain(qint64 ms) { m_lastDrain = ms; }
+    // Для простоя живой и тот, кто только читает
+    qint64 lastSeen() const { return qMax(m_lastActivity, m_lastDrain); }
+
+    // Входящие к нам пересылки, которые не успевали принимать: файл придет целиком в конце
+    QSet<quint64> &deferredRelays() { return m_deferredRelays; }
+
+private:
+    QTcpSocket *m_socket;
+    QString m_nick;
+    State m_state = State::Connected;
+    Protocol::FrameDecoder m_decoder;
+    Compression::Algorithm m_compression = Compression::Algorithm::None;
+    OutboundQueue m_outbound;
+    QHash<quint64, FileUpload*> m_uploads;
+    QSet<quint64> m_deferredRelays;
+    TimerWheel::Timer m_timer;
+    qint64 m_lastActivity = 0;
+    qint64 m_pingSentAt = -1;
+    qint64 m_lastDrain = 0;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "statsserver.h"
+#include "logger.h"
+#include "messagewriter.h"
+#include "servercontext.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+
+void appendMetric(QByteArray &out, const char *name, const char *type, const char *help, double value)
+{
+    out += QByteArray("# HELP ") + name + ' ' + help + '\n';
+    out += QByteArray("# TYPE ") + name + ' ' + type + '\n';
+    out += QByteArray(name) + ' ' + QByteArray::number(value, 'g', 15) + '\n';
+}
+
+// Гистограмму отдаем как summary: квантили в секундах, плюс _sum и _count
+void appendSummary(QByteArray &out, const char *name, const char *help, const Histogram &histogram)
+{
+    out += QByteArray("# HELP ") + name + ' ' + help + '\n';
+    out += QByteArray("# TYPE ") + name + " summary\n";
+    for (const char *q : {"0.5", "0.9", "0.99", "0.999"}) {
+        const double seconds = double(histogram.quantile(QByteArray(q).toDouble())) / 1e9;
+        out += QByteArray(name) + "{quantile=\"" + q + "\"} " + QByteArray::number(seconds, 'g', 6) + '\n';
+    }
+    out += QByteArray(name) + "_sum " + QByteArray::number(double(histogram.sum()) / 1e9, 'g', 15) + '\n';
+    out += QByteArray(name) + "_count " + QByteArray::number(histogram.count()) + '\n';
+}
+
+QString formatMicros(qint64 nanos)
+{
+    return QString::number(double(nanos) / 1000.0, 'f', 1) + "us";
+}
+
+QString latencyLine(const char *stage, const Histogram &histogram)
+{
+    return QString("SERVER: %1 p50 %2, p99 %3, p999 %4 (%5 samples)")
+        .arg(QString::fromLatin1(stage), formatMicros(histogram.quantile(0.5)), formatMicros(histogram.quantile(0.99)),
+             formatMicros(histogram.quantile(0.999)))
+        .arg(histogram.count());
+}
+
+}
+
+StatsServer::StatsServer(ServerContext *context, QObject *parent)
+    : QTcpServer(parent)
+    , m_context(context)
+{
+}
+
+QByteArray StatsServer::renderPrometheus(const ServerContext &context)
+{
+    const Metrics &m = context.metrics;
+    QByteArray out;
+    out.reserve(8 * 1024);
+
+    appendMetric(out, "messenger_uptime_seconds", "gauge", "Seconds since start.",
+                 context.startTime.secsTo(QDateTime::currentDateTime()));
+    appendMetric(out, "messenger_connections_accepted_total", "counter", "Accepted TCP connections.",
+                 m.connectionsAccepted.value());
+    appendMetric(out, "messenger_connections", "gauge", "Open client connections.", m.connections.value());
+    appendMetric(out, "messenger_users", "gauge", "Registered users online.", context.directory.size());
+    appendMetric(out, "messenger_bytes_in_total", "counter", "Bytes read from clients.", m.bytesIn.value());
+    appendMetric(out, "messenger_bytes_out_total", "counter", "Bytes written to clients.", m.bytesOut.value());
+    appendMetric(out, "messenger_outbound_queued_bytes", "gauge", "Bytes waiting in all outbound queues.",
+                 m.outboundQueuedBytes.value());
+
+    appendMetric(out, "messenger_frames_parsed_total", "counter", "Frames and text lines received.",
+                 m.framesParsed.value());
+    appendMetric(out, "messenger_messages_routed_total", "counter", "Deliveries to a single recipient.",
+                 m.messagesRouted.value());
+    appendMetric(out, "messenger_messages_persisted_total", "counter", "Messages written to the database.",
+                 m.messagesPersisted.value());
+    appendMetric(out, "messenger_messages_lost_total", "counter", "Messages dropped after a failed batch.",
+                 m.messagesLost.value());
+    appendMetric(out, "messenger_db_queue_depth", "gauge", "Messages waiting for the database.",
+                 context.writer ? context.writer->pending() : 0);
+    appendMetric(out, "messenger_history_requests_total", "counter", "History pages requested.",
+                 m.historyRequests.value());
+    appendMetric(out, "messenger_history_cache_hits_total", "counter", "History pages served from memory.",
+                 context.history.hits());
+    appendMetric(out, "messenger_history_cache_misses_total", "counter", "History pages loaded from the database.",
+                 context.history.misses());
+
+    appendMetric(out, "messenger_files_stored_total", "counter", "Files saved to the blob store.", m.filesStored.value());
+    appendMetric(out, "messenger_file_bytes_uploaded_total", "counter", "File bytes received.",
+                 m.fileBytesUploaded.value());
+    appendMetric(out, "messenger_file_bytes_relayed_total", "counter", "File bytes relayed live to recipients.",
+                 m.fileBytesRelayed.value());
+    appendMetric(out, "messenger_compression_input_bytes_total", "counter", "Uncompressed size of compressed payloads sent.",
+                 m.compressionInput.value());
+    appendMetric(out, "messenger_compression_output_bytes_total", "counter", "Compressed size of those payloads.",
+                 m.compressionOutput.value());
+    appendMetric(out, "messenger_pings_sent_total", "counter", "Heartbeat pings sent to silent clients.", m.pingsSent.value());
+    appendMetric(out, "messenger_pongs_received_total", "counter", "Heartbeat replies received.", m.pongsReceived.value());
+    appendMetric(out, "messenger_evicted_registration_total", "counter", "Connections closed for not registering in time.",
+                 m.evictedRegistration.value());
+    appendMetric(out, "messenger_evicted_heartbeat_total", "counter", "Connections closed for not answering a ping.",
+                 m.evictedHeartbeat.value());
+    appendMetric(out, "messenger_evicted_idle_total", "counter", "Connections closed after the idle timeout.",
+                 m.evictedIdle.value());
+    appendMetric(out, "messenger_log_dropped_total", "counter", "Log records dropped, buffer full.",
+                 Logger::instance().dropped());
+
+    appendSummary(out, "messenger_parse_seconds", "Decoding received bytes into frames.", m.parseLatency);
+    appendSummary(out, "messenger_route_seconds", "Delivering a message to one recipient.", m.routeLatency);
+    appendSummary(out, "messenger_persist_seconds", "One batched INSERT.", m.persistLatency);
+    appendSummary(out, "messenger_persist_delay_seconds", "From enqueue to database commit.", m.persistDelay);
+    appendSummary(out, "messenger_history_query_seconds", "One history page query.", m.historyQueryLatency);
+    appendSummary(out, "messenger_write_seconds", "Queueing data for a client socket.", m.writeLatency);
+    appendSummary(out, "messenger_ping_rtt_seconds", "From a heartbeat ping to the client's pong.", m.pingRtt);
+    return out;
+}
+
+QStringList StatsServer::summary(const ServerContext &context)
+{
+    const Metrics &m = context.metrics;
+    QStringList lines;
+    lines << QString("SERVER: %1 connections, %2 users, %3 bytes in, %4 bytes out, %5 bytes queued")
+                 .arg(m.connections.value()).arg(context.directory.size())
+                 .arg(m.bytesIn.value()).arg(m.bytesOut.value()).arg(m.outboundQueuedBytes.value());
+    lines << QString("SERVER: %1 frames, %2 routed, %3 persisted, %4 lost, %5 waiting for DB")
+                 .arg(m.framesParsed.value()).arg(m.messagesRouted.value()).arg(m.messagesPersisted.value())
+                 .arg(m.messagesLost.value()).arg(context.writer ? context.writer->pending() : 0);
+    lines << QString("SERVER: %1 files stored, %2 bytes uploaded, %3 bytes relayed")
+                 .arg(m.filesStored.value()).arg(m.fileBytesUploaded.value()).arg(m.fileBytesRelayed.value());
+    lines << QString("SERVER: %1 bytes compressed to %2")
+                 .arg(m.compressionInput.value()).arg(m.compressionOutput.value());
+    lines << QString("SERVER: %1 pings, %2 pongs; evicted %3 unregistered, %4 without pong, %5 idle")
+                 .arg(m.pingsSent.value()).arg(m.pongsReceived.value()).arg(m.evictedRegistration.value())
+                 .arg(m.evictedHeartbeat.value()).arg(m.evictedIdle.value());
+    lines << latencyLine("parse", m.parseLatency);
+    lines << latencyLine("route", m.routeLatency);
+    lines << latencyLine("persist", m.persistLatency);
+    lines << latencyLine("persist delay", m.persistDelay);
+    lines << latencyLine("history query", m.historyQueryLatency);
+    lines << latencyLine("write", m.writeLatency);
+    lines << latencyLine("ping rtt", m.pingRtt);
+    return lines;
+}
+
+void StatsServer::incomingConnection(qintptr socketDescriptor)
+{
+    auto *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+    connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    // Кто открыл соединение и молчит — не ждем вечно
+    QTimer::singleShot(5000, socket, [socket]() { socket->abort(); });
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+        if (!socket->canReadLine()) {
+            if (socket->bytesAvailable() > 4096) socket->abort();
+            return;
+        }
+        const QList<QByteArray> request = socket->readLine().trimmed().split(' ');
+        const bool ok = request.size() >= 2 && request.at(0) == "GET" &&
+                        (request.at(1) == "/metrics" || request.at(1) == "/");
+
+        const QByteArray body = ok ? renderPrometheus(*m_context) : QByteArray("Not found\n");
+        QByteArray response = ok ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n";
+        response += "Content-Type: text/plain; version=0.0.4\r\n";
+        response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+        response += "Connection: close\r\n\r\n";
+        socket->write(response + body);
+        socket->disconnectFromHost();
+    });
+}
@@ -0,0 +1,28 @@
+#ifndef STATSSERVER_H
+#define STATSSERVER_H
+
+#include <QByteArray>
+#include <QStringList>
+#include <QTcpServer>
+
+struct ServerContext;
+
+// Метрики в текстовом формате Prometheus (GET /metrics) на отдельном локальном порту.
+// Живет в главном потоке: запросы редкие, а все метрики читаются без блокировок
+class StatsServer : public QTcpServer {
+    Q_OBJECT
+public:
+    explicit StatsServer(ServerContext *context, QObject *parent = nullptr);
+
+    static QByteArray renderPrometheus(const ServerContext &context);
+    // Короткая сводка для команды /stats
+    static QStringList summary(const ServerContext &context);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    ServerContext *m_context;
+};
+
+#endif
@@ -0,0 +1,55 @@
+QT = core network sql testlib
+
+CONFIG += c++17 cmdline testcase
+
+TARGET = MessengerTests
+
+# Как и у сервера: zstd — только если есть libzstd
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += MESSENGER_HAVE_ZSTD
+}
+
+# Тестируем то, что не требует сети и БД: протокол, кэш истории, гистограммы, колесо таймеров,
+# журнал сообщений на диске, исходящая очередь (через сокет на localhost), кольцо логгера. Server::log подменяет serverlog.cpp
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../blobstore.cpp \
+        ../compression.cpp \
+        ../historycache.cpp \
+        ../logger.cpp \
+        ../logstore.cpp \
+        ../memorystore.cpp \
+        ../messagestore.cpp \
+        ../metrics.cpp \
+        ../outboundqueue.cpp \
+        ../pgstore.cpp \
+        ../protocol.cpp \
+        ../timerwheel.cpp \
+        main.cpp \
+        serverlog.cpp \
+        tst_blobstore.cpp \
+        tst_compression.cpp \
+        tst_histogram.cpp \
+        tst_historycache.cpp \
+        tst_logger.cpp \
+        tst_logstore.cpp \
+        tst_outboundqueue.cpp \
+        tst_protocol.cpp \
+        tst_timerwheel.cpp
+
+HEADERS += \
+    ../blobstore.h \
+    ../compression.h \
+    ../historycache.h \
+    ../logger.h \
+    ../logstore.h \
+    ../memorystore.h \
+    ../messagestore.h \
+    ../metrics.h \
+    ../outboundqueue.h \
+    ../pgstore.h \
+    ../protocol.h \
+    ../timerwheel.h
@@ -0,0 +1,30 @@
+#include <QCoreApplication>
+#include <QTest>
+
+// Каждый файл tst_*.cpp дает свою функцию, которая создает и прогоняет набор тестов
+int runProtocolTests(int argc, char **argv);
+int runHistoryCacheTests(int argc, char **argv);
+int runHistogramTests(int argc, char **argv);
+int runTimerWheelTests(int argc, char **argv);
+int runLogStoreTests(int argc, char **argv);
+int runOutboundQueueTests(int argc, char **argv);
+int runLoggerTests(int argc, char **argv);
+int runCompressionTests(int argc, char **argv);
+int runBlobStoreTests(int argc, char **argv);
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int failed = 0;
+    failed += runProtocolTests(argc, argv);
+    failed += runHistoryCacheTests(argc, argv);
+    failed += runHistogramTests(argc, argv);
+    failed += runTimerWheelTests(argc, argv);
+    failed += runLogStoreTests(argc, argv);
+    failed += runOutboundQueueTests(argc, argv);
+    failed += runLoggerTests(argc, argv);
+    failed += runCompressionTests(argc, argv);
+    failed += runBlobStoreTests(argc, argv);
+    return failed;
+}
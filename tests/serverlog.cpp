@@ -0,0 +1,12 @@
+#include "server.h"
+
+// Модули пишут в лог через Server::log, а сам сервер тестам не нужен — те же две строки, что в server.cpp
+void Server::log(const QString &message, LogLevel level)
+{
+    Logger::instance().write(level, QString(), QString(), message);
+}
+
+void Server::log(LogLevel level, const QString &event, const QString &user, const QString &message)
+{
+    Logger::instance().write(level, event, user, message);
+}
@@ -0,0 +1,143 @@
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+#include <memory>
+#include "blobstore.h"
+
+namespace {
+
+QByteArray text(int lines)
+{
+    return QByteArray("attachment line, compresses well\n").repeated(lines);
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+}
+
+class TestBlobStore : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        m_dir.reset(new QTemporaryDir);
+        QVERIFY(m_dir->isValid());
+        m_blobs.reset(new BlobStore);
+        m_blobs->setRoot(m_dir->filePath("blobs"));
+    }
+
+    // Хранилище первым: его фоновое сжатие еще может писать в каталог
+    void cleanup()
+    {
+        m_blobs.reset();
+        m_dir.reset();
+    }
+
+    void storeDeduplicates()
+    {
+        const QByteArray hash = m_blobs->store(text(10));
+        QVERIFY(BlobStore::isValidHash(hash));
+        QCOMPARE(m_blobs->store(text(10)), hash);
+        QCOMPARE(m_blobs->refCount(hash), 2);
+        QCOMPARE(m_blobs->size(hash), qint64(text(10).size()));
+    }
+
+    void adoptMovesOrDropsSource()
+    {
+        const QByteArray hash = m_blobs->store(text(10));
+        const QString spool = m_dir->filePath("upload.part");
+        QVERIFY(writeFile(spool, text(10)));
+
+        // Такой файл уже есть — спул просто удаляется, ссылка добавляется
+        QVERIFY(m_blobs->adopt(spool, hash));
+        QVERIFY(!QFile::exists(spool));
+        QCOMPARE(m_blobs->refCount(hash), 2);
+
+        const QByteArray other = "ab" + QByteArray(62, 'c');
+        QVERIFY(writeFile(spool, text(3)));
+        QVERIFY(m_blobs->adopt(spool, other));
+        QVERIFY(!QFile::exists(spool));
+        QVERIFY(QFile::exists(m_blobs->path(other)));
+        QCOMPARE(m_blobs->refCount(other), 1);
+
+        QVERIFY(!m_blobs->adopt(spool, "not a hash"));
+    }
+
+    // Файл и его сжатые копии живут до последней ссылки
+    void releaseDeletesAtZero()
+    {
+        const QByteArray hash = m_blobs->store(text(1000));
+        QCOMPARE(m_blobs->store(text(1000)), hash);
+
+        qint64 packedSize = 0;
+        QString packedPath;
+        QTRY_VERIFY(!(packedPath = m_blobs->packed(hash, Compression::Algorithm::Deflate, packedSize)).isEmpty());
+        QVERIFY(packedSize > 0);
+        QVERIFY(packedSize < m_blobs->size(hash));
+
+        m_blobs->release(hash);
+        QCOMPARE(m_blobs->refCount(hash), 1);
+        QVERIFY(QFile::exists(m_blobs->path(hash)));
+        QVERIFY(QFile::exists(packedPath));
+
+        m_blobs->release(hash);
+        QCOMPARE(m_blobs->refCount(hash), 0);
+        QVERIFY(!QFile::exists(m_blobs->path(hash)));
+        QVERIFY(!QFile::exists(packedPath));
+
+        // Лишний release ничего не ломает
+        m_blobs->release(hash);
+        QCOMPARE(m_blobs->refCount(hash), 0);
+    }
+
+    void precompressedIsNotPacked()
+    {
+        const QByteArray png = QByteArray::fromHex("89504e470d0a1a0a") + text(1000);
+        const QByteArray hash = m_blobs->store(png);
+        qint64 packedSize = 0;
+        QVERIFY(m_blobs->packed(hash, Compression::Algorithm::Deflate, packedSize).isEmpty());
+        // Задача сжатия отказывается от файла, и повторный запрос больше ее не ставит
+        QTest::qWait(200);
+        QVERIFY(m_blobs->packed(hash, Compression::Algorithm::Deflate, packedSize).isEmpty());
+        QVERIFY(!QFile::exists(m_blobs->path(hash) + ".deflate"));
+    }
+
+    void removeUnreferencedKeepsCounted()
+    {
+        const QByteArray kept = m_blobs->store(text(1000));
+        const QByteArray orphan = m_blobs->store(text(20));
+        qint64 packedSize = 0;
+        QTRY_VERIFY(!m_blobs->packed(kept, Compression::Algorithm::Deflate, packedSize).isEmpty());
+        // Сжатая копия файла без ссылок уходит вместе с ним
+        QVERIFY(writeFile(m_blobs->path(orphan) + ".deflate", "stale"));
+
+        QHash<QByteArray, int> counts;
+        counts.insert(kept, 3);
+        m_blobs->loadRefCounts(counts);
+        QCOMPARE(m_blobs->refCount(kept), 3);
+        QCOMPARE(m_blobs->refCount(orphan), 0);
+
+        QCOMPARE(m_blobs->removeUnreferenced(), 2);
+        QVERIFY(QFile::exists(m_blobs->path(kept)));
+        QVERIFY(QFile::exists(m_blobs->path(kept) + ".deflate"));
+        QVERIFY(!QFile::exists(m_blobs->path(orphan)));
+        QVERIFY(!QFile::exists(m_blobs->path(orphan) + ".deflate"));
+    }
+
+private:
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<BlobStore> m_blobs;
+};
+
+int runBlobStoreTests(int argc, char **argv)
+{
+    TestBlobStore test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_blobstore.moc"
@@ -0,0 +1,104 @@
+#include <QTest>
+#include <QtEndian>
+#include "compression.h"
+
+using Compression::Algorithm;
+using Compression::bit;
+
+class TestCompression : public QObject {
+    Q_OBJECT
+
+private slots:
+    void negotiatePrefersBest()
+    {
+        const quint32 all = bit(Algorithm::Deflate) | bit(Algorithm::Zstd);
+        const Algorithm best = (Compression::available() & bit(Algorithm::Zstd)) ? Algorithm::Zstd : Algorithm::Deflate;
+        QCOMPARE(Compression::negotiate(all, all), best);
+        QCOMPARE(Compression::negotiate(bit(Algorithm::Deflate), all), Algorithm::Deflate);
+        QCOMPARE(Compression::negotiate(all, bit(Algorithm::Deflate)), Algorithm::Deflate);
+    }
+
+    void negotiateWithoutCommonIsNone()
+    {
+        const quint32 all = bit(Algorithm::Deflate) | bit(Algorithm::Zstd);
+        QCOMPARE(Compression::negotiate(0, all), Algorithm::None);
+        QCOMPARE(Compression::negotiate(all, 0), Algorithm::None);
+        QCOMPARE(Compression::negotiate(bit(Algorithm::Zstd), bit(Algorithm::Deflate)), Algorithm::None);
+    }
+
+    // Поток deflate — это qCompress без 4 байт длины: возвращаем их и разжимаем обратно
+    void deflateRoundTrip()
+    {
+        const QByteArray data = QByteArray("hello, messenger! ").repeated(200);
+        const QByteArray packed = Compression::compress(Algorithm::Deflate, data);
+        QVERIFY(!packed.isEmpty());
+        QVERIFY(packed.size() < data.size());
+
+        QByteArray withLength(4, Qt::Uninitialized);
+        qToBigEndian<quint32>(quint32(data.size()), withLength.data());
+        QCOMPARE(qUncompress(withLength + packed), data);
+    }
+
+    void incompressibleIsEmpty()
+    {
+        QByteArray data(4096, Qt::Uninitialized);
+        quint32 state = 12345;
+        for (char &c : data) {
+            state = state * 1664525u + 1013904223u;
+            c = char(state >> 24);
+        }
+        QVERIFY(Compression::compress(Algorithm::Deflate, data).isEmpty());
+        QVERIFY(Compression::compress(Algorithm::None, data).isEmpty());
+    }
+
+    void isPrecompressed_data()
+    {
+        QTest::addColumn<QByteArray>("head");
+        QTest::addColumn<bool>("expected");
+        QTest::newRow("png") << QByteArray::fromHex("89504e470d0a1a0a") << true;
+        QTest::newRow("jpeg") << QByteArray::fromHex("ffd8ffe000104a46") << true;
+        QTest::newRow("gzip") << QByteArray::fromHex("1f8b080000000000") << true;
+        QTest::newRow("zip") << QByteArray("PK\x03\x04....") << true;
+        QTest::newRow("webp") << QByteArray("RIFF\x10\x00\x00\x00WEBPVP8 ", 16) << true;
+        QTest::newRow("mp4") << QByteArray("\x00\x00\x00\x18" "ftypmp42", 12) << true;
+        QTest::newRow("mp3 id3") << QByteArray("ID3\x04\x00\x00") << true;
+        QTest::newRow("mp3 frame") << QByteArray::fromHex("fffb9064") << true;  // MPEG-1 Layer III, 128 кбит/с, 44,1 кГц
+        QTest::newRow("mp2 frame") << QByteArray::fromHex("fffdc004") << true;  // MPEG-1 Layer II
+        QTest::newRow("mpeg2 frame") << QByteArray::fromHex("fff39064") << true; // MPEG-2 Layer III
+        QTest::newRow("adts") << QByteArray::fromHex("fff15080") << true;
+        QTest::newRow("utf16le bom") << QByteArray("\xFF\xFEH\x00i\x00!\x00", 8) << false;
+        QTest::newRow("utf16be bom") << QByteArray("\xFE\xFF\x00H\x00i", 6) << false;
+        QTest::newRow("reserved version") << QByteArray::fromHex("ffeb9064") << false;
+        QTest::newRow("reserved layer") << QByteArray::fromHex("ffe19064") << false;
+        QTest::newRow("bad bitrate") << QByteArray::fromHex("fffbf064") << false;
+        QTest::newRow("reserved sampling") << QByteArray::fromHex("fffb9c64") << false;
+        QTest::newRow("adts reserved sampling") << QByteArray::fromHex("fff17480") << false;
+        QTest::newRow("too short") << QByteArray::fromHex("fffb") << false;
+        QTest::newRow("text") << QByteArray("plain text file") << false;
+        QTest::newRow("empty") << QByteArray() << false;
+    }
+
+    void isPrecompressed()
+    {
+        QFETCH(QByteArray, head);
+        QFETCH(bool, expected);
+        QCOMPARE(Compression::isPrecompressed(head), expected);
+    }
+
+    void isPrecompressedName()
+    {
+        QVERIFY(Compression::isPrecompressedName("photo.JPG"));
+        QVERIFY(Compression::isPrecompressedName("dir/archive.tar.gz"));
+        QVERIFY(Compression::isPrecompressedName("song.mp3"));
+        QVERIFY(!Compression::isPrecompressedName("notes.txt"));
+        QVERIFY(!Compression::isPrecompressedName("README"));
+    }
+};
+
+int runCompressionTests(int argc, char **argv)
+{
+    TestCompression test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_compression.moc"
@@ -0,0 +1,73 @@
+#include <QTest>
+#include "metrics.h"
+
+class TestHistogram : public QObject {
+    Q_OBJECT
+
+private slots:
+    void empty()
+    {
+        Histogram histogram;
+        QCOMPARE(histogram.count(), quint64(0));
+        QCOMPARE(histogram.quantile(0.5), qint64(0));
+    }
+
+    // Маленькие значения лежат каждое в своей корзине
+    void smallValuesAreExact()
+    {
+        Histogram histogram;
+        for (qint64 value = 0; value < 16; ++value) histogram.record(value);
+        QCOMPARE(histogram.count(), quint64(16));
+        QCOMPARE(histogram.sum(), quint64(120));
+        QCOMPARE(histogram.quantile(0.0), qint64(0));
+        QCOMPARE(histogram.quantile(1.0), qint64(15));
+    }
+
+    void negativeCountsAsZero()
+    {
+        Histogram histogram;
+        histogram.record(-5);
+        QCOMPARE(histogram.sum(), quint64(0));
+        QCOMPARE(histogram.quantile(1.0), qint64(0));
+    }
+
+    void quantileWithinError_data()
+    {
+        QTest::addColumn<qint64>("value");
+        QTest::newRow("microsecond") << qint64(1000);
+        QTest::newRow("odd") << qint64(123457);
+        QTest::newRow("second") << qint64(1000000000);
+        QTest::newRow("hour") << qint64(3600) * 1000000000;
+    }
+
+    // 16 корзин на степень двойки — ошибка не больше 1/16 от значения
+    void quantileWithinError()
+    {
+        QFETCH(qint64, value);
+        Histogram histogram;
+        histogram.record(value);
+        const qint64 estimate = histogram.quantile(0.5);
+        QVERIFY2(qAbs(estimate - value) <= value / 16,
+                 qPrintable(QString("%1 estimated as %2").arg(value).arg(estimate)));
+    }
+
+    void quantilesAreOrdered()
+    {
+        Histogram histogram;
+        for (qint64 value = 1; value <= 1000; ++value) histogram.record(value * 1000);
+
+        const qint64 p50 = histogram.quantile(0.5);
+        const qint64 p99 = histogram.quantile(0.99);
+        QVERIFY(p50 <= p99);
+        QVERIFY(qAbs(p50 - 500000) <= 500000 / 16);
+        QVERIFY(qAbs(p99 - 990000) <= 990000 / 16);
+    }
+};
+
+int runHistogramTests(int argc, char **argv)
+{
+    TestHistogram test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_histogram.moc"
@@ -0,0 +1,177 @@
+#include <QTest>
+#include "historycache.h"
+
+namespace {
+
+HistoryEntry entry(quint64 id)
+{
+    HistoryEntry e;
+    e.id = id;
+    e.sender = "alice";
+    e.message = QString("message %1").arg(id);
+    return e;
+}
+
+QList<quint64> ids(const QList<HistoryEntry> &entries)
+{
+    QList<quint64> out;
+    for (const HistoryEntry &e : entries) out.append(e.id);
+    return out;
+}
+
+}
+
+class TestHistoryCache : public QObject {
+    Q_OBJECT
+
+private slots:
+    void keyIsSymmetric()
+    {
+        QCOMPARE(HistoryCache::conversationKey("alice", "bob"), HistoryCache::conversationKey("bob", "alice"));
+        QVERIFY(HistoryCache::conversationKey("a", "bc") != HistoryCache::conversationKey("ab", "c"));
+    }
+
+    // Пока не было fill(), разговор неполный — отвечать из памяти нельзя
+    void missUntilFilled()
+    {
+        HistoryCache cache;
+        cache.setLimits(10, 5);
+        QList<HistoryEntry> out;
+
+        cache.append("k", entry(1));
+        QVERIFY(!cache.recent("k", out));
+        QCOMPARE(cache.misses(), quint64(1));
+
+        cache.fill("k", {entry(1)}, cache.beginFill());
+        QVERIFY(cache.recent("k", out));
+        QCOMPARE(ids(out), QList<quint64>({1}));
+        QCOMPARE(cache.hits(), quint64(1));
+    }
+
+    // То, что пришло, пока ходили в БД, не теряется и идет после результата запроса
+    void fillKeepsNewerEntries()
+    {
+        HistoryCache cache;
+        cache.setLimits(10, 5);
+        cache.append("k", entry(7));
+        cache.fill("k", {entry(5), entry(6)}, cache.beginFill());
+
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("k", out));
+        QCOMPARE(ids(out), QList<quint64>({5, 6, 7}));
+    }
+
+    void ringKeepsLatest()
+    {
+        HistoryCache cache;
+        cache.setLimits(10, 3);
+        cache.fill("k", {}, cache.beginFill());
+        for (quint64 id = 1; id <= 5; ++id) cache.append("k", entry(id));
+
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("k", out));
+        QCOMPARE(ids(out), QList<quint64>({3, 4, 5}));
+    }
+
+    // Шарды кладут соседние id не по порядку — курсор страницы (первый id) должен остаться верным
+    void appendKeepsIdOrder()
+    {
+        HistoryCache cache;
+        cache.setLimits(10, 3);
+        cache.fill("k", {entry(1)}, cache.beginFill());
+        cache.append("k", entry(3));
+        cache.append("k", entry(2));
+        cache.append("k", entry(5));
+        cache.append("k", entry(4));
+        cache.append("k", entry(4));
+
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("k", out));
+        QCOMPARE(ids(out), QList<quint64>({3, 4, 5}));
+    }
+
+    // Разговор вытеснили, пока сообщение ждало записи: страница из БД его не содержит, но кэш помнит
+    void fillMergesUnflushed()
+    {
+        HistoryCache cache;
+        cache.setLimits(1, 5);
+        cache.fill("a", {entry(1)}, cache.beginFill());
+        cache.append("a", entry(2));
+        cache.fill("b", {}, cache.beginFill()); // "a" вытеснен
+
+        cache.fill("a", {entry(1)}, cache.beginFill());
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("a", out));
+        QCOMPARE(ids(out), QList<quint64>({1, 2}));
+
+        // Записано и никто не ждет — дальше его отдает хранилище
+        cache.flushed("a", 2);
+        cache.fill("b", {}, cache.beginFill());
+        cache.fill("a", {entry(1)}, cache.beginFill());
+        QVERIFY(cache.recent("a", out));
+        QCOMPARE(ids(out), QList<quint64>({1}));
+    }
+
+    // Записали, пока шел запрос к БД: запрос мог этого не увидеть, так что сообщение все равно попадает в кэш
+    void flushDuringFillIsKept()
+    {
+        HistoryCache cache;
+        cache.setLimits(1, 5);
+        cache.append("a", entry(1));
+        cache.fill("b", {}, cache.beginFill()); // "a" вытеснен
+
+        const quint64 ticket = cache.beginFill();
+        cache.flushed("a", 1);
+        cache.fill("a", {}, ticket);
+
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("a", out));
+        QCOMPARE(ids(out), QList<quint64>({1}));
+    }
+
+    void evictsLeastRecentlyUsed()
+    {
+        HistoryCache cache;
+        cache.setLimits(2, 5);
+        cache.fill("a", {entry(1)}, cache.beginFill());
+        cache.fill("b", {entry(2)}, cache.beginFill());
+
+        QList<HistoryEntry> out;
+        QVERIFY(cache.recent("a", out)); // "a" свежее, вытеснен будет "b"
+        cache.fill("c", {entry(3)}, cache.beginFill());
+
+        QCOMPARE(cache.conversations(), 2);
+        QVERIFY(cache.recent("a", out));
+        QVERIFY(cache.recent("c", out));
+        QVERIFY(!cache.recent("b", out));
+    }
+
+    // После компактизации разговор снова неполный — отвечает хранилище, а не старая копия
+    void invalidateForgetsConversation()
+    {
+        HistoryCache cache;
+        cache.setLimits(10, 5);
+        cache.fill("a", {entry(1), entry(2)}, cache.beginFill());
+        cache.fill("b", {entry(3)}, cache.beginFill());
+
+        cache.invalidate("a");
+        cache.invalidate("missing");
+
+        QList<HistoryEntry> out;
+        QVERIFY(!cache.recent("a", out));
+        QVERIFY(cache.recent("b", out));
+        QCOMPARE(cache.conversations(), 1);
+
+        cache.fill("a", {entry(2)}, cache.beginFill());
+        QVERIFY(cache.recent("a", out));
+        QCOMPARE(ids(out), QList<quint64>({2}));
+    }
+};
+
+int runHistoryCacheTests(int argc, char **argv)
+{
+    TestHistoryCache test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_historycache.moc"
@@ -0,0 +1,70 @@
+#include <QTemporaryDir>
+#include <QTest>
+#include "config.h"
+#include "logger.h"
+
+class TestLogger : public QObject {
+    Q_OBJECT
+
+private slots:
+    // Кольцо полно — запись выбрасывается и считается, а потом о потерях пишется одна строка
+    void overflowCountsDrops()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        ServerConfig config;
+        config.logBufferSize = 64;
+        config.logFile = dir.filePath("server.log");
+
+        Logger logger;
+        logger.configure(config);
+        // Флаг есть, а потока еще нет — как будто он не успевает разбирать
+        logger.m_running.store(true);
+        for (int i = 0; i < 100; ++i)
+            logger.write(LogLevel::Info, "test", QString(), QString("record %1").arg(i));
+        QCOMPARE(logger.dropped(), quint64(36));
+
+        logger.QThread::start();
+        logger.stop();
+
+        QFile file(config.logFile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QList<QByteArray> lines = file.readAll().split('\n');
+        QCOMPARE(lines.size(), 66); // 64 записи, строка о потерях и пустой хвост после последнего \n
+        QVERIFY(lines.at(0).endsWith("event=test record 0"));
+        QVERIFY(lines.at(63).endsWith("event=test record 63"));
+        QVERIFY(lines.at(64).contains("event=log_dropped"));
+        QVERIFY(lines.at(64).contains("36 log records dropped"));
+    }
+
+    // Ниже уровня запись даже не попадает в кольцо
+    void belowLevelIsSkipped()
+    {
+        QTemporaryDir dir;
+        ServerConfig config;
+        config.logBufferSize = 64;
+        config.logFile = dir.filePath("server.log");
+
+        Logger logger;
+        logger.configure(config);
+        logger.m_running.store(true);
+        QVERIFY(!Logger::enabled(LogLevel::Debug));
+        for (int i = 0; i < 100; ++i)
+            logger.write(LogLevel::Debug, "test", QString(), "hidden");
+        QCOMPARE(logger.dropped(), quint64(0));
+
+        logger.QThread::start();
+        logger.stop();
+        QFile file(config.logFile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.size(), qint64(0));
+    }
+};
+
+int runLoggerTests(int argc, char **argv)
+{
+    TestLogger test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_logger.moc"
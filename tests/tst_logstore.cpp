@@ -0,0 +1,166 @@
+#include <QTemporaryDir>
+#include <QTest>
+#include "logstore.h"
+#include "servercontext.h"
+
+namespace {
+
+MessageRecord message(quint64 id, const QDateTime &at = QDateTime::currentDateTime(), const QString &text = QString())
+{
+    MessageRecord record;
+    record.id = id;
+    record.sender = "alice";
+    record.receiver = "bob";
+    record.message = text.isEmpty() ? QString("message %1").arg(id) : text;
+    record.timestamp = at;
+    return record;
+}
+
+QList<quint64> storedIds(LogStore &store)
+{
+    QList<HistoryEntry> entries;
+    if (!store.loadPage("alice", "bob", 0, 100, entries)) return {};
+    QList<quint64> out;
+    for (const HistoryEntry &e : std::as_const(entries)) out.append(e.id);
+    return out;
+}
+
+}
+
+class TestLogStore : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        m_dir.reset(new QTemporaryDir);
+        QVERIFY(m_dir->isValid());
+        m_context.reset(new ServerContext);
+        m_context->config.storeDir = m_dir->filePath("messages");
+        m_context->config.storeSegmentSize = 64 * 1024;
+        m_context->blobs.setRoot(m_dir->filePath("blobs"));
+    }
+
+    void reopenKeepsMessages()
+    {
+        {
+            LogStore store(m_context.get());
+            QVERIFY(store.open());
+            QVERIFY(store.append({message(1), message(2)}));
+            QVERIFY(store.append({message(3)}));
+        }
+
+        LogStore store(m_context.get());
+        QVERIFY(store.open());
+        quint64 last = 0;
+        QVERIFY(store.lastId(last));
+        QCOMPARE(last, quint64(3));
+        QCOMPARE(storedIds(store), QList<quint64>({1, 2, 3}));
+    }
+
+    // Упали посреди записи пачки: недописанная запись отрезается, следующая пачка ложится на ее место
+    void tornTailIsTruncated()
+    {
+        {
+            LogStore store(m_context.get());
+            QVERIFY(store.open());
+            QVERIFY(store.append({message(1), message(2), message(3)}));
+        }
+        {
+            QFile segment(m_dir->filePath("messages/seg-000001.log"));
+            QVERIFY(segment.open(QIODevice::Append));
+            // Заголовок обещает 100 байт, а дошло три
+            segment.write(QByteArray("\x64\x00\x00\x00\x12\x34\x56\x78" "abc", 11));
+        }
+
+        {
+            LogStore store(m_context.get());
+            QVERIFY(store.open());
+            QCOMPARE(storedIds(store), QList<quint64>({1, 2, 3}));
+            QVERIFY(store.append({message(4)}));
+        }
+
+        LogStore store(m_context.get());
+        QVERIFY(store.open());
+        QCOMPARE(storedIds(store), QList<quint64>({1, 2, 3, 4}));
+    }
+
+    // Аварийная остановка оставляет запас активного сегмента нулями — это не порча
+    void zeroTailIsReserve()
+    {
+        {
+            LogStore store(m_context.get());
+            QVERIFY(store.open());
+            QVERIFY(store.append({message(1), message(2)}));
+        }
+        {
+            QFile segment(m_dir->filePath("messages/seg-000001.log"));
+            QVERIFY(segment.resize(segment.size() + 4096));
+        }
+
+        {
+            LogStore store(m_context.get());
+            QVERIFY(store.open());
+            QCOMPARE(storedIds(store), QList<quint64>({1, 2}));
+            QVERIFY(store.append({message(3)}));
+        }
+
+        LogStore store(m_context.get());
+        QVERIFY(store.open());
+        QCOMPARE(storedIds(store), QList<quint64>({1, 2, 3}));
+    }
+
+    // Просроченное выбрасывается из закрытого сегмента вместе с вложениями и копией в кэше истории
+    void retentionCompactsClosedSegments()
+    {
+        m_context->config.storeRetentionDays = 1;
+        m_context->config.storeSegmentSize = 512;
+        const QDateTime old = QDateTime::currentDateTime().addDays(-3);
+
+        const QByteArray hash = m_context->blobs.store("attachment body");
+        QVERIFY(!hash.isEmpty());
+        MessageRecord file = message(2, old, "photo.jpg");
+        file.isFile = true;
+        file.blobHash = hash;
+        file.fileSize = 15;
+
+        LogStore store(m_context.get());
+        QVERIFY(store.open());
+        QVERIFY(store.append({message(1, old), file, message(3)}));
+        // Не влезает в остаток сегмента — первый закрывается
+        QVERIFY(store.append({message(4, QDateTime::currentDateTime(), QString(600, 'x'))}));
+        QVERIFY(QFile::exists(m_dir->filePath("messages/seg-000002.log")));
+
+        const QString key = HistoryCache::conversationKey("alice", "bob");
+        QList<HistoryEntry> entries;
+        QVERIFY(store.loadPage("alice", "bob", 0, 100, entries));
+        m_context->history.fill(key, entries, m_context->history.beginFill());
+        QVERIFY(m_context->history.recent(key, entries));
+
+        store.maintain();
+
+        QCOMPARE(storedIds(store), QList<quint64>({3, 4}));
+        StoredFile stored;
+        QVERIFY(!store.findFile(2, stored));
+        QCOMPARE(m_context->blobs.refCount(hash), 0);
+        QVERIFY(!QFile::exists(m_context->blobs.path(hash)));
+        QVERIFY(!m_context->history.recent(key, entries));
+
+        store.close();
+        LogStore reopened(m_context.get());
+        QVERIFY(reopened.open());
+        QCOMPARE(storedIds(reopened), QList<quint64>({3, 4}));
+    }
+
+private:
+    std::unique_ptr<QTemporaryDir> m_dir;
+    std::unique_ptr<ServerContext> m_context;
+};
+
+int runLogStoreTests(int argc, char **argv)
+{
+    TestLogStore test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_logstore.moc"
@@ -0,0 +1,134 @@
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTest>
+#include <memory>
+#include "outboundqueue.h"
+
+// Пока event loop не крутится, записанное копится в буфере сокета — очередь видит его в bytesToWrite()
+class TestOutboundQueue : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        m_config = ServerConfig();
+        m_config.outHighWatermark = 1000;
+        m_config.outLowWatermark = 500;
+        m_config.outHardLimit = 4000;
+        m_config.slowConsumerPolicy = SlowConsumerPolicy::DropPresence;
+
+        m_server.reset(new QTcpServer);
+        QVERIFY(m_server->listen(QHostAddress::LocalHost));
+        m_client.reset(new QTcpSocket);
+        m_client->connectToHost(m_server->serverAddress(), m_server->serverPort());
+        QVERIFY(m_server->waitForNewConnection(5000));
+        m_socket.reset(m_server->nextPendingConnection());
+        QVERIFY(m_client->waitForConnected(5000));
+        m_metrics.reset(new Metrics);
+    }
+
+    void cleanup()
+    {
+        m_socket.reset();
+        m_client.reset();
+        m_server.reset();
+    }
+
+    // Выше верхней отметки — медленный, присутствие выбрасывается; ниже нижней — снова нормальный
+    // и получает полный список один раз
+    void congestionAndRecovery()
+    {
+        OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+
+        QVERIFY(queue.write(QByteArray(600, 'a')));
+        QVERIFY(!queue.isCongested());
+        QVERIFY(queue.write(QByteArray(600, 'b')));
+        QVERIFY(queue.isCongested());
+        QCOMPARE(queue.stats().congestions, quint64(1));
+        QCOMPARE(m_metrics->outboundQueuedBytes.value(), qint64(1200));
+
+        QVERIFY(!queue.write("presence", OutboundQueue::Kind::Presence));
+        QCOMPARE(queue.stats().droppedPresence, quint64(1));
+        QVERIFY(!queue.takePresenceResync()); // пока медленный — рано
+
+        QTRY_COMPARE(m_socket->bytesToWrite(), qint64(0));
+        queue.pump();
+        QVERIFY(!queue.isCongested());
+        QVERIFY(!queue.isOverflowed());
+        QVERIFY(queue.takePresenceResync());
+        QVERIFY(!queue.takePresenceResync());
+        QCOMPARE(m_metrics->outboundQueuedBytes.value(), qint64(0));
+    }
+
+    // Между отметками состояние не меняется: гистерезис
+    void staysCongestedAboveLow()
+    {
+        OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+        QVERIFY(queue.write(QByteArray(1200, 'a')));
+        QVERIFY(queue.isCongested());
+        QVERIFY(queue.write(QByteArray(100, 'b')));
+        QVERIFY(queue.isCongested());
+        QCOMPARE(queue.stats().congestions, quint64(1));
+    }
+
+    void hardLimitDisconnects()
+    {
+        OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+        for (int i = 0; i < 4; ++i)
+            QVERIFY(queue.write(QByteArray(1000, 'a')));
+        QVERIFY(!queue.isOverflowed());
+
+        QVERIFY(!queue.write(QByteArray(1000, 'b')));
+        QVERIFY(queue.isOverflowed());
+        QVERIFY(!queue.write("after"));
+        QCOMPARE(m_metrics->outboundQueuedBytes.value(), qint64(0));
+
+        // Сброс отложенный — не посреди цикла по сессиям
+        QCOMPARE(m_socket->state(), QAbstractSocket::ConnectedState);
+        QTRY_COMPARE(m_socket->state(), QAbstractSocket::UnconnectedState);
+    }
+
+    // Один большой кадр в пустую очередь пропускаем: до него клиент успевал
+    void singleLargeFrameIsAllowed()
+    {
+        OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+        QVERIFY(queue.write(QByteArray(10000, 'a')));
+        QVERIFY(!queue.isOverflowed());
+        QVERIFY(queue.isCongested());
+    }
+
+    void disconnectPolicyDropsAtHigh()
+    {
+        m_config.slowConsumerPolicy = SlowConsumerPolicy::Disconnect;
+        OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+        QVERIFY(queue.write(QByteArray(800, 'a')));
+        QVERIFY(!queue.write(QByteArray(800, 'b')));
+        QVERIFY(queue.isOverflowed());
+    }
+
+    // Своя доля в общей метрике уходит вместе с очередью
+    void gaugeReleasedOnDestruction()
+    {
+        {
+            OutboundQueue queue(m_socket.get(), m_config, m_metrics.get());
+            QVERIFY(queue.write(QByteArray(700, 'a')));
+            QCOMPARE(m_metrics->outboundQueuedBytes.value(), qint64(700));
+        }
+        QCOMPARE(m_metrics->outboundQueuedBytes.value(), qint64(0));
+    }
+
+private:
+    ServerConfig m_config;
+    std::unique_ptr<QTcpServer> m_server;
+    std::unique_ptr<QTcpSocket> m_client;
+    std::unique_ptr<QTcpSocket> m_socket;
+    std::unique_ptr<Metrics> m_metrics;
+};
+
+int runOutboundQueueTests(int argc, char **argv)
+{
+    TestOutboundQueue test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_outboundqueue.moc"
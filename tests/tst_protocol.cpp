@@ -0,0 +1,178 @@
+#include <QTest>
+#include "protocol.h"
+
+using namespace Protocol;
+
+namespace {
+
+QByteArray frame(FrameType type, const QByteArray &payload)
+{
+    return encodeFrame(type, payload);
+}
+
+}
+
+class TestProtocol : public QObject {
+    Q_OBJECT
+
+private slots:
+    void varintRoundTrip_data()
+    {
+        QTest::addColumn<quint64>("value");
+        QTest::newRow("zero") << quint64(0);
+        QTest::newRow("one byte") << quint64(127);
+        QTest::newRow("two bytes") << quint64(128);
+        QTest::newRow("large") << (quint64(1) << 40);
+        QTest::newRow("max") << ~quint64(0);
+    }
+
+    void varintRoundTrip()
+    {
+        QFETCH(quint64, value);
+        QByteArray encoded;
+        appendVarint(encoded, value);
+        QVERIFY(encoded.size() <= 10);
+
+        PayloadReader reader(encoded);
+        quint64 decoded = 0;
+        QVERIFY(reader.readVarint(decoded));
+        QCOMPARE(decoded, value);
+        QVERIFY(reader.rest().isEmpty());
+    }
+
+    void readFieldRejectsShortPayload()
+    {
+        QByteArray payload;
+        appendVarint(payload, 10);
+        payload.append("abc");
+
+        PayloadReader reader(payload);
+        QByteArrayView field;
+        QVERIFY(!reader.readField(field));
+        // Неудачное чтение ничего не съедает
+        QCOMPARE(reader.rest().size(), payload.size());
+    }
+
+    void legacyDetection()
+    {
+        FrameDecoder decoder;
+        decoder.feed("alice");
+        QCOMPARE(decoder.mode(), FrameDecoder::Mode::Legacy);
+
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::NeedMore);
+        decoder.feed(" more");
+        QCOMPARE(decoder.takeLegacy(), QByteArray("alice more"));
+    }
+
+    void preambleSplitAcrossReads()
+    {
+        FrameDecoder decoder;
+        const QByteArray data = preamble() + frame(FrameType::Text, "hi");
+
+        decoder.feed(data.left(2));
+        QCOMPARE(decoder.mode(), FrameDecoder::Mode::Detecting);
+        decoder.feed(data.mid(2));
+        QCOMPARE(decoder.mode(), FrameDecoder::Mode::Binary);
+
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Frame);
+        QCOMPARE(out.type, FrameType::Text);
+        QCOMPARE(out.payload.toByteArray(), QByteArray("hi"));
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::NeedMore);
+    }
+
+    void badPreamble()
+    {
+        FrameDecoder decoder;
+        decoder.feed(QByteArray("\0XYZ\1", 5));
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Error);
+        QVERIFY(!decoder.errorString().isEmpty());
+    }
+
+    void unsupportedVersion()
+    {
+        FrameDecoder decoder;
+        decoder.feed(QByteArray(kMagic, kMagicSize) + char(kVersion + 1));
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Error);
+    }
+
+    // Кадр, разрезанный на куски по одному байту, собирается целиком
+    void splitFrame()
+    {
+        FrameDecoder decoder;
+        decoder.feed(preamble());
+        const QByteArray payload(300, 'x'); // длина — двухбайтовый varint
+        const QByteArray data = frame(FrameType::File, payload);
+
+        Frame out;
+        for (qsizetype i = 0; i < data.size() - 1; ++i) {
+            decoder.feed(data.mid(i, 1));
+            QCOMPARE(decoder.next(out), FrameDecoder::Status::NeedMore);
+        }
+        decoder.feed(data.right(1));
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Frame);
+        QCOMPARE(out.type, FrameType::File);
+        QCOMPARE(out.payload.toByteArray(), payload);
+    }
+
+    // Несколько кадров за одно чтение, последний — не до конца
+    void mergedFrames()
+    {
+        FrameDecoder decoder;
+        const QByteArray tail = frame(FrameType::Text, "third");
+        decoder.feed(preamble() + frame(FrameType::Text, "first") + frame(FrameType::Ack, QByteArray())
+                     + tail.left(3));
+
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Frame);
+        QCOMPARE(out.payload.toByteArray(), QByteArray("first"));
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Frame);
+        QCOMPARE(out.type, FrameType::Ack);
+        QVERIFY(out.payload.isEmpty());
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::NeedMore);
+
+        decoder.feed(tail.mid(3));
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Frame);
+        QCOMPARE(out.payload.toByteArray(), QByteArray("third"));
+        QCOMPARE(decoder.bufferedBytes(), qsizetype(0));
+    }
+
+    void oversizeFrame()
+    {
+        FrameDecoder decoder;
+        decoder.feed(preamble() + encodeFrameHeader(FrameType::File, quint64(kMaxFrameSize) + 1));
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Error);
+
+        // После ошибки декодер больше ничего не принимает
+        decoder.feed(frame(FrameType::Text, "late"));
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Error);
+    }
+
+    void malformedLength()
+    {
+        FrameDecoder decoder;
+        decoder.feed(preamble() + char(FrameType::Text) + QByteArray(10, char(0x80)));
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::Error);
+    }
+
+    void truncatedLengthWaits()
+    {
+        FrameDecoder decoder;
+        decoder.feed(preamble() + char(FrameType::Text) + QByteArray(3, char(0x80)));
+        Frame out;
+        QCOMPARE(decoder.next(out), FrameDecoder::Status::NeedMore);
+    }
+};
+
+int runProtocolTests(int argc, char **argv)
+{
+    TestProtocol test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_protocol.moc"
@@ -0,0 +1,204 @@
+#include <QTest>
+#include <memory>
+#include "timerwheel.h"
+
+class TestTimerWheel : public QObject {
+    Q_OBJECT
+
+private slots:
+    // Срок округляется вверх до тика и не наступает раньше
+    void firesOnDeadline()
+    {
+        TimerWheel wheel(100);
+        TimerWheel::Timer timer(nullptr);
+        int fired = 0;
+        const auto count = [&fired](TimerWheel::Timer *) { ++fired; };
+
+        wheel.schedule(&timer, 250);
+        QVERIFY(timer.isActive());
+        QCOMPARE(wheel.size(), 1);
+
+        wheel.advanceTo(299, count);
+        QCOMPARE(fired, 0);
+        wheel.advanceTo(300, count);
+        QCOMPARE(fired, 1);
+        QVERIFY(!timer.isActive());
+        QCOMPARE(wheel.size(), 0);
+        QCOMPARE(wheel.now(), qint64(300));
+    }
+
+    // Нулевой срок — следующий тик, а не сейчас
+    void zeroDelayWaitsForNextTick()
+    {
+        TimerWheel wheel(100);
+        TimerWheel::Timer timer(nullptr);
+        int fired = 0;
+        wheel.advanceTo(150, [](TimerWheel::Timer *) {});
+
+        wheel.schedule(&timer, 0);
+        wheel.advanceTo(199, [&fired](TimerWheel::Timer *) { ++fired; });
+        QCOMPARE(fired, 0);
+        wheel.advanceTo(200, [&fired](TimerWheel::Timer *) { ++fired; });
+        QCOMPARE(fired, 1);
+    }
+
+    // Дальние сроки спускаются по уровням и срабатывают ровно в свой тик,
+    // в том числе когда колесо стартует не с границы оборота
+    void cascadeAcrossLevels_data()
+    {
+        QTest::addColumn<qint64>("startTicks");
+        QTest::addColumn<qint64>("delayTicks");
+
+        QTest::newRow("level 0") << qint64(0) << qint64(63);
+        QTest::newRow("level 1 boundary") << qint64(0) << qint64(64);
+        QTest::newRow("level 1 unaligned") << qint64(37) << qint64(1000);
+        QTest::newRow("level 2") << qint64(37) << qint64(64 * 64 + 5);
+        QTest::newRow("level 3") << qint64(4095) << qint64(64 * 64 * 64 + 123);
+    }
+
+    void cascadeAcrossLevels()
+    {
+        QFETCH(qint64, startTicks);
+        QFETCH(qint64, delayTicks);
+
+        TimerWheel wheel(1);
+        TimerWheel::Timer timer(nullptr);
+        qint64 firedAt = -1;
+        const auto record = [&wheel, &firedAt](TimerWheel::Timer *) { firedAt = wheel.now(); };
+
+        // Второй таймер держит колесо непустым, чтобы оно шло тик за тиком
+        TimerWheel::Timer anchor(nullptr);
+        wheel.schedule(&anchor, startTicks + delayTicks + 10);
+        wheel.advanceTo(startTicks, record);
+        wheel.schedule(&timer, delayTicks);
+
+        wheel.advanceTo(startTicks + delayTicks - 1, record);
+        QCOMPARE(firedAt, qint64(-1));
+        wheel.advanceTo(startTicks + delayTicks, record);
+        QCOMPARE(firedAt, startTicks + delayTicks);
+    }
+
+    void cancelPreventsFiring()
+    {
+        TimerWheel wheel(100);
+        TimerWheel::Timer timer(nullptr);
+        int fired = 0;
+
+        wheel.schedule(&timer, 500);
+        wheel.cancel(&timer);
+        QVERIFY(!timer.isActive());
+        QCOMPARE(wheel.size(), 0);
+        // Повторная отмена безвредна
+        wheel.cancel(&timer);
+
+        wheel.advanceTo(10000, [&fired](TimerWheel::Timer *) { ++fired; });
+        QCOMPARE(fired, 0);
+    }
+
+    // Повторный schedule переставляет, а не добавляет второй раз
+    void rescheduleMoves()
+    {
+        TimerWheel wheel(100);
+        TimerWheel::Timer timer(nullptr);
+        QList<qint64> firedAt;
+        const auto record = [&wheel, &firedAt](TimerWheel::Timer *) { firedAt.append(wheel.now()); };
+
+        wheel.schedule(&timer, 200);
+        wheel.schedule(&timer, 10000);
+        QCOMPARE(wheel.size(), 1);
+
+        wheel.advanceTo(20000, record);
+        QCOMPARE(firedAt, QList<qint64>({10000}));
+    }
+
+    // Из обработчика таймер ставится снова — как пульс сессии
+    void rescheduleInsideCallback()
+    {
+        TimerWheel wheel(100);
+        TimerWheel::Timer timer(nullptr);
+        QList<qint64> firedAt;
+
+        wheel.schedule(&timer, 300);
+        wheel.advanceTo(1000, [&](TimerWheel::Timer *t) {
+            firedAt.append(wheel.now());
+            wheel.schedule(t, 300);
+        });
+        QCOMPARE(firedAt, QList<qint64>({300, 600, 900}));
+        QVERIFY(timer.isActive());
+        QCOMPARE(wheel.size(), 1);
+    }
+
+    // Обработчик снимает соседа по тому же тику и таймер на потом — они не срабатывают
+    void cancelOtherInsideCallback()
+    {
+        TimerWheel wheel(100);
+        int first = 1;
+        int second = 2;
+        int later = 3;
+        TimerWheel::Timer a(&first);
+        TimerWheel::Timer b(&second);
+        TimerWheel::Timer c(&later);
+        QList<void*> fired;
+
+        wheel.schedule(&a, 200);
+        wheel.schedule(&b, 200);
+        wheel.schedule(&c, 5000);
+        wheel.advanceTo(10000, [&](TimerWheel::Timer *t) {
+            fired.append(t->owner());
+            wheel.cancel(t == &a ? &b : &a);
+            wheel.cancel(&c);
+        });
+
+        QCOMPARE(fired.size(), 1);
+        QVERIFY(!a.isActive());
+        QVERIFY(!b.isActive());
+        QVERIFY(!c.isActive());
+        QCOMPARE(wheel.size(), 0);
+    }
+
+    // Сессия может удалиться прямо из обработчика соседа
+    void deleteOtherInsideCallback()
+    {
+        TimerWheel wheel(100);
+        auto a = std::make_unique<TimerWheel::Timer>(nullptr);
+        auto b = std::make_unique<TimerWheel::Timer>(nullptr);
+        int fired = 0;
+
+        wheel.schedule(a.get(), 100);
+        wheel.schedule(b.get(), 100);
+        wheel.advanceTo(1000, [&](TimerWheel::Timer *t) {
+            ++fired;
+            if (t == a.get()) b.reset();
+            else a.reset();
+        });
+
+        QCOMPARE(fired, 1);
+        QCOMPARE(wheel.size(), 0);
+    }
+
+    // Колесо ушло раньше таймеров — они просто отвязаны
+    void wheelDestroyedFirst()
+    {
+        TimerWheel::Timer timer(nullptr);
+        {
+            TimerWheel wheel(100);
+            wheel.schedule(&timer, 100);
+            QVERIFY(timer.isActive());
+        }
+        QVERIFY(!timer.isActive());
+
+        TimerWheel other(100);
+        int fired = 0;
+        other.schedule(&timer, 100);
+        other.advanceTo(100, [&fired](TimerWheel::Timer *) { ++fired; });
+        QCOMPARE(fired, 1);
+    }
+};
+
+int runTimerWheelTests(int argc, char **argv)
+{
+    TestTimerWheel test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_timerwheel.moc"
@@ -0,0 +1,88 @@
+#include "timerwheel.h"
+
+void TimerWheel::Timer::unlink()
+{
+    if (!m_wheel) return;
+    m_prev->m_next = m_next;
+    m_next->m_prev = m_prev;
+    m_prev = m_next = nullptr;
+    --m_wheel->m_count;
+    m_wheel = nullptr;
+}
+
+TimerWheel::TimerWheel(int tickMs)
+    : m_tickMs(qMax(1, tickMs))
+{
+}
+
+// Таймеры живут в сессиях и могут пережить колесо — отвязываем их, чтобы не лезли в чужую память
+TimerWheel::~TimerWheel()
+{
+    for (auto &level : m_slots) {
+        for (Slot &slot : level) {
+            Timer *timer = slot.head.m_next;
+            while (timer != &slot.head) {
+                Timer *next = timer->m_next;
+                timer->m_prev = timer->m_next = nullptr;
+                timer->m_wheel = nullptr;
+                timer = next;
+            }
+            slot.head.m_prev = slot.head.m_next = &slot.head;
+        }
+    }
+    m_count = 0;
+}
+
+void TimerWheel::schedule(Timer *timer, qint64 delayMs)
+{
+    timer->unlink();
+
+    const quint64 ticks = delayMs <= 0 ? 1 : (quint64(delayMs) + m_tickMs - 1) / m_tickMs;
+    timer->m_deadline = m_now + qBound<quint64>(1, ticks, kMaxTicks);
+    timer->m_wheel = this;
+    ++m_count;
+    insert(timer);
+}
+
+// Уровень — самый нижний, в пределах оборота которого лежит срок; ячейка — его разряды на этом уровне
+void TimerWheel::insert(Timer *timer)
+{
+    const quint64 deadline = timer->m_deadline;
+    int level = 0;
+    while (level < kLevels - 1
+           && (deadline >> ((level + 1) * kSlotBits)) != (m_now >> ((level + 1) * kSlotBits)))
+        ++level;
+
+    Timer &head = m_slots[level][(deadline >> (level * kSlotBits)) & kSlotMask].head;
+    timer->m_prev = head.m_prev;
+    timer->m_next = &head;
+    head.m_prev->m_next = timer;
+    head.m_prev = timer;
+}
+
+// Время дошло до ячейки верхнего уровня — раскладываем ее таймеры по нижним
+void TimerWheel::cascade(int level)
+{
+    Timer list{nullptr};
+    list.m_prev = list.m_next = &list;
+    splice(m_slots[level][(m_now >> (level * kSlotBits)) & kSlotMask], list);
+
+    while (list.m_next != &list) {
+        Timer *timer = list.m_next;
+        list.m_next = timer->m_next;
+        timer->m_next->m_prev = &list;
+        insert(timer);
+    }
+}
+
+void TimerWheel::splice(Slot &slot, Timer &list)
+{
+    Timer &head = slot.head;
+    if (head.m_next == &head) return;
+
+    list.m_next = head.m_next;
+    list.m_prev = head.m_prev;
+    list.m_next->m_prev = &list;
+    list.m_prev->m_next = &list;
+    head.m_prev = head.m_next = &head;
+}
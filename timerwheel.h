@@ -0,0 +1,109 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QtGlobal>
+#include <array>
+
+// Иерархическое колесо таймеров: 4 уровня по 64 ячейки, тик по умолчанию 100 мс — хватает на ~19 суток.
+// Поставить, снять и сработать — O(1), на тик — только своя ячейка и изредка перенос ячейки
+// уровня выше вниз. Таймеры встроены в владельцев (сессии), памяти под них колесо не выделяет.
+// Однопоточное: живет в потоке шарда вместе со своими таймерами.
+class TimerWheel {
+public:
+    class Timer {
+    public:
+        explicit Timer(void *owner) : m_owner(owner) {}
+        ~Timer() { unlink(); }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        void *owner() const { return m_owner; }
+        bool isActive() const { return m_wheel != nullptr; }
+
+    private:
+        friend class TimerWheel;
+
+        void unlink();
+
+        void *m_owner;
+        Timer *m_prev = nullptr;
+        Timer *m_next = nullptr;
+        TimerWheel *m_wheel = nullptr;
+        quint64 m_deadline = 0; // в тиках
+    };
+
+    explicit TimerWheel(int tickMs = 100);
+    ~TimerWheel();
+
+    Q_DISABLE_COPY(TimerWheel)
+
+    int tickMs() const { return m_tickMs; }
+    // Текущее время колеса в мс (с точностью до тика), отсчет от создания
+    qint64 now() const { return qint64(m_now) * m_tickMs; }
+    int size() const { return m_count; }
+
+    // Переставляет, если таймер уже стоит. Срабатывает не раньше, чем через delayMs (округление вверх до тика)
+    void schedule(Timer *timer, qint64 delayMs);
+    void cancel(Timer *timer) { timer->unlink(); }
+
+    // Догоняет время elapsedMs (мс от создания колеса) и зовет expired(Timer*) для каждого сработавшего.
+    // Таймер снят до вызова — в обработчике его можно поставить снова; снимать и удалять другие тоже можно.
+    template <typename Callback>
+    void advanceTo(qint64 elapsedMs, Callback &&expired);
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 6;
+    static constexpr int kSlots = 1 << kSlotBits;
+    static constexpr quint64 kSlotMask = kSlots - 1;
+    // Дальше верхнего уровня не заглядываем: дальний срок ставится на самый поздний
+    static constexpr quint64 kMaxTicks = (quint64(1) << (kLevels * kSlotBits)) - (quint64(1) << ((kLevels - 1) * kSlotBits));
+
+    // Кольцевой двусвязный список ячейки с заглушкой в голове
+    struct Slot {
+        Timer head{nullptr};
+        Slot() { head.m_prev = head.m_next = &head; }
+    };
+
+    void insert(Timer *timer);
+    void cascade(int level);
+    // Забирает из ячейки всё разом в list (пустой), ячейка остается пустой
+    static void splice(Slot &slot, Timer &list);
+
+    int m_tickMs;
+    quint64 m_now = 0;
+    int m_count = 0;
+    std::array<std::array<Slot, kSlots>, kLevels> m_slots;
+};
+
+template <typename Callback>
+void TimerWheel::advanceTo(qint64 elapsedMs, Callback &&expired)
+{
+    const quint64 target = quint64(qMax<qint64>(0, elapsedMs) / m_tickMs);
+    while (m_now < target) {
+        // Пустое колесо просто догоняет часы
+        if (m_count == 0) {
+            m_now = target;
+            return;
+        }
+
+        ++m_now;
+        // Сверху вниз: ячейка уровня 2 может высыпаться в ту ячейку уровня 1, которую переносим следом
+        for (int level = kLevels - 1; level > 0; --level) {
+            if ((m_now & ((quint64(1) << (level * kSlotBits)) - 1)) == 0)
+                cascade(level);
+        }
+
+        Timer due{nullptr};
+        due.m_prev = due.m_next = &due;
+        splice(m_slots[0][m_now & kSlotMask], due);
+        while (due.m_next != &due) {
+            Timer *timer = due.m_next;
+            timer->unlink();
+            expired(timer);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include "userdirectory.h"
+
+bool UserDirectory::insert(const QString &nick, const Entry &entry)
+{
+    Stripe &stripe = stripeFor(nick);
+    QWriteLocker locker(&stripe.lock);
+    if (stripe.users.contains(nick)) return false;
+
+    stripe.users.insert(nick, entry);
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void UserDirectory::remove(const QString &nick, Session *session)
+{
+    Stripe &stripe = stripeFor(nick);
+    QWriteLocker locker(&stripe.lock);
+    auto it = stripe.users.find(nick);
+    if (it == stripe.users.end() || it->session != session) return;
+
+    stripe.users.erase(it);
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool UserDirectory::lookup(const QString &nick, Entry &entry) const
+{
+    const Stripe &stripe = stripeFor(nick);
+    QReadLocker locker(&stripe.lock);
+    auto it = stripe.users.constFind(nick);
+    if (it == stripe.users.cend()) return false;
+
+    entry = *it;
+    return true;
+}
+
+QStringList UserDirectory::nicks() const
+{
+    QStringList result;
+    result.reserve(size());
+    for (const Stripe &stripe : m_stripes) {
+        QReadLocker locker(&stripe.lock);
+        for (auto it = stripe.users.cbegin(); it != stripe.users.cend(); ++it)
+            result.append(it.key());
+    }
+    // Раньше список шел из QMap и был отсортирован — клиенты к этому привыкли
+    result.sort();
+    return result;
+}
@@ -0,0 +1,48 @@
+#ifndef USERDIRECTORY_H
+#define USERDIRECTORY_H
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include "compression.h"
+
+class Server;
+class Session;
+
+// Общий на все шарды каталог "ник -> где он подключен".
+// Разбит на полосы со своими блокировками, чтобы шарды не толкались на одном мьютексе.
+class UserDirectory {
+public:
+    struct Entry {
+        Server *shard = nullptr;
+        Session *session = nullptr; // трогать только из потока shard
+        bool binary = false;
+        Compression::Algorithm compression = Compression::Algorithm::None;
+    };
+
+    // false, если ник уже занят
+    bool insert(const QString &nick, const Entry &entry);
+    // Удаляет, только если ник все еще принадлежит этой сессии
+    void remove(const QString &nick, Session *session);
+    bool lookup(const QString &nick, Entry &entry) const;
+    QStringList nicks() const;
+    int size() const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int kStripes = 64;
+
+    struct Stripe {
+        mutable QReadWriteLock lock;
+        QHash<QString, Entry> users;
+    };
+
+    Stripe &stripeFor(const QString &nick) { return m_stripes[qHash(nick) % kStripes]; }
+    const Stripe &stripeFor(const QString &nick) const { return m_stripes[qHash(nick) % kStripes]; }
+
+    Stripe m_stripes[kStripes];
+    std::atomic<int> m_size{0};
+};
+
+#endif